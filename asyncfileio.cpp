@@ -0,0 +1,472 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "asyncfileio.h"
+
+#include <QFile>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Threads doing blocking I/O when io_uring isn't available
+static const int blockingThreads = 4;
+
+#ifdef HAVE_IO_URING
+// Requests in flight on the ring at a time
+static const unsigned ringEntries = 64;
+
+// The largest transfer submitted at once, short of the 2 GB limit of read()
+static const size_t maximumTransfer = 1 << 30;
+
+struct AsyncFileIO::Ring
+{
+    ~Ring()
+    {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqPointer && cqPointer != sqPointer)
+            munmap(cqPointer, cqSize);
+        if (sqPointer)
+            munmap(sqPointer, sqSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    int fd = -1;
+    unsigned entries = 0;
+    void *sqPointer = nullptr;
+    void *cqPointer = nullptr;
+    size_t sqSize = 0;
+    size_t cqSize = 0;
+    size_t sqesSize = 0;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    // Requests in flight by the slot in the user data of their entries
+    vector<RequestPointer> requestSlots;
+    vector<iovec> iovecs;
+    vector<unsigned> freeSlots;
+};
+#else
+struct AsyncFileIO::Ring
+{
+};
+#endif
+
+AsyncFileIO::AsyncFileIO() :
+    m_pendingWrites(0),
+    m_stopping(false)
+{
+    if (setupRing()) {
+        m_threads.push_back(thread([this]() { runRing(); }));
+    } else {
+        for (int i = 0; i < blockingThreads; i++)
+            m_threads.push_back(thread([this]() { runBlocking(); }));
+    }
+}
+
+AsyncFileIO::~AsyncFileIO()
+{
+    flush();
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queued.notify_all();
+    for (thread &t : m_threads)
+        t.join();
+}
+
+bool AsyncFileIO::usesIoUring() const
+{
+    return m_ring != nullptr;
+}
+
+void AsyncFileIO::prefetch(const QString &filename)
+{
+    RequestPointer request = make_shared<Request>();
+    request->filename = filename;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_reads.contains(filename))
+            return;
+        m_reads.insert(filename, request);
+    }
+    submit(request);
+}
+
+void AsyncFileIO::read(const QString &filename, QObject *context,
+                       const function<void(bool, const QByteArray &)> &callback)
+{
+    RequestPointer request;
+    bool done = false;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        request = m_reads.take(filename);
+        if (request) {
+            request->context = context;
+            request->callback = callback;
+            done = request->done;
+        }
+    }
+
+    if (!request) {
+        request = make_shared<Request>();
+        request->filename = filename;
+        request->context = context;
+        request->callback = callback;
+        submit(request);
+    } else if (done) {
+        deliver(request);
+    }
+}
+
+void AsyncFileIO::deliver(const RequestPointer &request)
+{
+    QMetaObject::invokeMethod(request->context, [request]() {
+        request->callback(request->ok, request->data);
+    }, Qt::QueuedConnection);
+}
+
+void AsyncFileIO::write(const QString &filename, const QByteArray &data)
+{
+    RequestPointer request = make_shared<Request>();
+    request->filename = filename;
+    request->data = data;
+    request->isWrite = true;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_pendingWrites++;
+    }
+    submit(request);
+}
+
+QStringList AsyncFileIO::flush()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_finished.wait(lock, [this]() { return m_pendingWrites == 0; });
+    QStringList failedWrites = m_failedWrites;
+    m_failedWrites.clear();
+    return failedWrites;
+}
+
+void AsyncFileIO::submit(const RequestPointer &request)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_queue.push_back(request);
+    }
+    m_queued.notify_one();
+}
+
+void AsyncFileIO::finish(const RequestPointer &request, bool ok)
+{
+    bool waitedFor;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        request->done = true;
+        request->ok = ok;
+        waitedFor = request->callback != nullptr;
+        if (request->isWrite) {
+            m_pendingWrites--;
+            if (!ok)
+                m_failedWrites.append(request->filename);
+            // The data isn't needed anymore
+            request->data = QByteArray();
+        }
+    }
+    m_finished.notify_all();
+
+    // Prefetches nobody asked for yet call back once read() takes them over
+    if (waitedFor)
+        deliver(request);
+}
+
+void AsyncFileIO::runBlocking()
+{
+    while (true) {
+        RequestPointer request;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_queued.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;
+            request = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        QFile file(request->filename);
+        bool ok;
+        if (request->isWrite) {
+            ok = file.open(QIODevice::WriteOnly) && file.write(request->data) == request->data.size();
+        } else {
+            ok = file.open(QIODevice::ReadOnly);
+            if (ok)
+                request->data = file.readAll();
+        }
+        finish(request, ok);
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+bool AsyncFileIO::setupRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    unique_ptr<Ring> ring(new Ring);
+    ring->fd = syscall(__NR_io_uring_setup, ringEntries, &params);
+    if (ring->fd < 0)
+        return false;
+
+    ring->entries = params.sq_entries;
+    ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    // Kernel headers older than 5.4 don't know about the shared mapping
+#ifdef IORING_FEAT_SINGLE_MMAP
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+#else
+    bool singleMap = false;
+#endif
+    if (singleMap)
+        ring->sqSize = ring->cqSize = max(ring->sqSize, ring->cqSize);
+
+    ring->sqPointer = mmap(nullptr, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqPointer == MAP_FAILED) {
+        ring->sqPointer = nullptr;
+        return false;
+    }
+    if (singleMap) {
+        ring->cqPointer = ring->sqPointer;
+    } else {
+        ring->cqPointer = mmap(nullptr, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqPointer == MAP_FAILED) {
+            ring->cqPointer = nullptr;
+            return false;
+        }
+    }
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    ring->sqes = static_cast<io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(ring->sqPointer);
+    char *cq = static_cast<char *>(ring->cqPointer);
+    ring->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    ring->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    ring->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    ring->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    ring->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    ring->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    ring->requestSlots.resize(ring->entries);
+    ring->iovecs.resize(ring->entries);
+    for (unsigned slot = 0; slot < ring->entries; slot++)
+        ring->freeSlots.push_back(slot);
+
+    m_ring = move(ring);
+    return true;
+}
+
+bool AsyncFileIO::openRequest(Request *request)
+{
+    QByteArray filename = QFile::encodeName(request->filename);
+    request->fd = request->isWrite ? open(filename.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+                                   : open(filename.constData(), O_RDONLY | O_CLOEXEC);
+    if (request->fd < 0)
+        return false;
+
+    if (!request->isWrite) {
+        struct stat status;
+        if (fstat(request->fd, &status) != 0) {
+            close(request->fd);
+            return false;
+        }
+        request->data.resize(status.st_size);
+    }
+    return true;
+}
+
+void AsyncFileIO::runRing()
+{
+    Ring *ring = m_ring.get();
+    unsigned inFlight = 0;
+
+    // Puts the next part of the transfer of the request in the slot on the ring
+    unsigned toSubmit = 0;
+    auto queueTransfer = [&](unsigned slot) {
+        Request *request = ring->requestSlots[slot].get();
+        iovec &transfer = ring->iovecs[slot];
+        transfer.iov_base = const_cast<char *>(request->data.constData()) + request->offset;
+        transfer.iov_len = min<size_t>(request->data.size() - request->offset, maximumTransfer);
+
+        unsigned tail = *ring->sqTail;
+        unsigned index = tail & *ring->sqMask;
+        io_uring_sqe *entry = &ring->sqes[index];
+        memset(entry, 0, sizeof(*entry));
+        entry->opcode = request->isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+        entry->fd = request->fd;
+        entry->off = request->offset;
+        entry->addr = reinterpret_cast<__u64>(&transfer);
+        entry->len = 1;
+        entry->user_data = slot;
+        ring->sqArray[index] = index;
+        __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    };
+
+    auto complete = [&](unsigned slot, bool ok) {
+        RequestPointer request = ring->requestSlots[slot];
+        ring->requestSlots[slot].reset();
+        ring->freeSlots.push_back(slot);
+        inFlight--;
+        close(request->fd);
+        finish(request, ok);
+    };
+
+    while (true) {
+        vector<RequestPointer> started;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            // New requests are picked up when something completes while
+            // others are in flight
+            if (inFlight == 0)
+                m_queued.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (inFlight == 0 && m_queue.empty())
+                return;
+            while (!m_queue.empty() && inFlight + started.size() < ring->entries) {
+                started.push_back(m_queue.front());
+                m_queue.pop_front();
+            }
+        }
+
+        for (const RequestPointer &request : started) {
+            if (!openRequest(request.get())) {
+                finish(request, false);
+            } else if (request->data.isEmpty()) {
+                close(request->fd);
+                finish(request, true);
+            } else {
+                unsigned slot = ring->freeSlots.back();
+                ring->freeSlots.pop_back();
+                ring->requestSlots[slot] = request;
+                inFlight++;
+                queueTransfer(slot);
+            }
+        }
+
+        if (inFlight == 0)
+            continue;
+
+        if (syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                && errno != EINTR) {
+            // The ring is broken, so fail everything in flight
+            for (unsigned slot = 0; slot < ring->entries; slot++) {
+                if (ring->requestSlots[slot])
+                    complete(slot, false);
+            }
+            toSubmit = 0;
+            continue;
+        }
+        toSubmit = 0;
+
+        unsigned head = *ring->cqHead;
+        vector<unsigned> continued;
+        while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe &completion = ring->cqes[head & *ring->cqMask];
+            unsigned slot = completion.user_data;
+            int result = completion.res;
+            head++;
+
+            Request *request = ring->requestSlots[slot].get();
+            if (result == -EINTR || result == -EAGAIN) {
+                continued.push_back(slot);
+            } else if (result < 0) {
+                complete(slot, false);
+            } else if (result == 0) {
+                // The file got shorter since it was opened
+                if (!request->isWrite)
+                    request->data.resize(request->offset);
+                complete(slot, !request->isWrite);
+            } else {
+                request->offset += result;
+                if (request->offset < request->data.size())
+                    continued.push_back(slot);
+                else
+                    complete(slot, true);
+            }
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+        for (unsigned slot : continued)
+            queueTransfer(slot);
+    }
+}
+
+#else
+
+bool AsyncFileIO::setupRing()
+{
+    return false;
+}
+
+bool AsyncFileIO::openRequest(Request *)
+{
+    return false;
+}
+
+void AsyncFileIO::runRing()
+{
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef ASYNCFILEIO_H
+#define ASYNCFILEIO_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reads and writes whole files in the background, so that the latency of
+// slow (e.g. network mounted) file systems overlaps with other work. On Linux
+// the reads and writes are submitted in batches to io_uring from a single
+// thread. If io_uring isn't available, a few threads do blocking I/O instead.
+class AsyncFileIO
+{
+public:
+    AsyncFileIO();
+    // Waits for the queued writes
+    ~AsyncFileIO();
+
+    bool usesIoUring() const;
+
+    // Starts reading the file into memory, so that read() finds it there
+    void prefetch(const QString &filename);
+
+    // Reads the file, or takes over a prefetch of it, and calls back with
+    // whether that worked and the contents from the event loop of the thread
+    // of context, so that the caller never waits. context has to outlive
+    // this object. The prefetched copy is released.
+    void read(const QString &filename, QObject *context,
+              const std::function<void(bool ok, const QByteArray &data)> &callback);
+
+    // Queues writing data into the file, replacing it
+    void write(const QString &filename, const QByteArray &data);
+
+    // Waits for the queued writes. Returns the files which couldn't be
+    // written since the previous flush().
+    QStringList flush();
+
+private:
+    struct Request
+    {
+        QString filename;
+        QByteArray data;
+        bool isWrite = false;
+        int fd = -1;
+        qint64 offset = 0;
+        bool done = false;
+        bool ok = false;
+        QObject *context = nullptr;
+        std::function<void(bool, const QByteArray &)> callback;
+    };
+    typedef std::shared_ptr<Request> RequestPointer;
+
+    static void deliver(const RequestPointer &request);
+    void submit(const RequestPointer &request);
+    void finish(const RequestPointer &request, bool ok);
+    void runBlocking();
+    bool openRequest(Request *request);
+    bool setupRing();
+    void runRing();
+
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_finished;
+    std::deque<RequestPointer> m_queue;
+    QHash<QString, RequestPointer> m_reads;
+    int m_pendingWrites;
+    QStringList m_failedWrites;
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+
+    // io_uring state, owned by the single I/O thread
+    struct Ring;
+    std::unique_ptr<Ring> m_ring;
+};
+
+#endif // ASYNCFILEIO_H
@@ -0,0 +1,467 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "batch.h"
+#include "messages.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QPointer>
+#include <string.h>
+
+// Number of times a job is started before it is given up on
+static const int maximumAttempts = 3;
+// Number of queued jobs whose inputs are read ahead
+static const int prefetchDepth = 8;
+
+// Batch protocol messages
+enum MessageType : quint8
+{
+    RequestJobMessage,  // worker: nothing
+    JobMessage,         // coordinator: job, input file name, input, bake arguments, output suffix
+    ResultMessage,      // worker: job, success, output, log
+    NoMoreJobsMessage   // coordinator: nothing
+};
+
+BatchCoordinator::BatchCoordinator(const QStringList &bakeArguments) :
+    m_bakeArguments(bakeArguments),
+    m_failedJobs(0)
+{
+    QObject::connect(&m_server, &QTcpServer::newConnection, [this]() { acceptConnection(); });
+}
+
+BatchCoordinator::~BatchCoordinator()
+{
+    // Hang up on the workers still running copies of finished jobs, so that
+    // the local ones exit
+    for (QTcpSocket *socket : m_runningJob.keys()) {
+        socket->disconnect();
+        socket->abort();
+    }
+    for (QProcess *process : m_localWorkers) {
+        process->waitForFinished();
+        delete process;
+    }
+}
+
+bool BatchCoordinator::loadManifest(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning("Failed to open %s", qPrintable(filename));
+        return false;
+    }
+
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine()).trimmed();
+        lineNumber++;
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+
+        QStringList fields = line.contains("\t") ? line.split("\t", QString::SkipEmptyParts)
+                                                 : line.split(" ", QString::SkipEmptyParts);
+        if (fields.count() != 2) {
+            qWarning("Expected an input and an output file on line %d of %s", lineNumber, qPrintable(filename));
+            return false;
+        }
+
+        addJob(fields.at(0).trimmed(), fields.at(1).trimmed());
+    }
+
+    if (m_jobs.isEmpty()) {
+        qWarning("No jobs in %s", qPrintable(filename));
+        return false;
+    }
+    return true;
+}
+
+void BatchCoordinator::addJob(const QString &input, const QString &output,
+                              const QStringList &arguments)
+{
+    Job job;
+    job.input = input;
+    job.output = output;
+    job.arguments = arguments;
+    m_jobs.append(job);
+    m_queue.append(m_jobs.count() - 1);
+}
+
+bool BatchCoordinator::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_server.listen(address, port)) {
+        qWarning("Failed to listen on port %d: %s", port, qPrintable(m_server.errorString()));
+        return false;
+    }
+    qInfo("Waiting for workers on port %d to bake %d jobs", m_server.serverPort(), m_jobs.count());
+    return true;
+}
+
+void BatchCoordinator::startLocalWorkers(int count)
+{
+    // Workers on this machine reach a coordinator listening on all interfaces
+    // through the loopback one
+    QHostAddress address = m_server.serverAddress();
+    if (address == QHostAddress::Any || address == QHostAddress::AnyIPv4)
+        address = QHostAddress::LocalHost;
+    else if (address == QHostAddress::AnyIPv6)
+        address = QHostAddress::LocalHostIPv6;
+    QStringList arguments;
+    arguments << "--worker" << QString("%1:%2").arg(address.toString()).arg(m_server.serverPort());
+    for (int i = 0; i < count; i++) {
+        QProcess *process = new QProcess;
+        process->setProcessChannelMode(QProcess::ForwardedChannels);
+        process->start(QCoreApplication::applicationFilePath(), arguments);
+        m_localWorkers.append(process);
+    }
+}
+
+void BatchCoordinator::acceptConnection()
+{
+    while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+        qInfo("Worker %s connected", qPrintable(socket->peerAddress().toString()));
+        m_runningJob.insert(socket, -1);
+        QObject::connect(socket, &QTcpSocket::readyRead, [this, socket]() { readMessages(socket); });
+        QObject::connect(socket, &QTcpSocket::disconnected, [this, socket]() { workerLost(socket); });
+    }
+}
+
+void BatchCoordinator::readMessages(QTcpSocket *socket)
+{
+    receiveMessages(socket, [&](QDataStream &message) {
+        quint8 type;
+        message >> type;
+        if (type == RequestJobMessage) {
+            assignJob(socket);
+        } else if (type == ResultMessage) {
+            qint32 job;
+            bool success;
+            QByteArray output;
+            QString log;
+            message >> job >> success >> output >> log;
+            finishJob(socket, job, success, output, log);
+            assignJob(socket);
+        }
+    });
+}
+
+void BatchCoordinator::finishJob(QTcpSocket *socket, int job, bool success,
+                                 const QByteArray &output, const QString &log)
+{
+    // Only the worker the job was handed to may deliver its result
+    if (job < 0 || job >= m_jobs.count() || m_runningJob.value(socket, -1) != job
+            || !m_jobs.at(job).workers.contains(socket)) {
+        qWarning("Ignoring a result for job %d from %s, which wasn't assigned to it", job,
+                 qPrintable(socket->peerAddress().toString()));
+        return;
+    }
+
+    m_runningJob[socket] = -1;
+    Job &j = m_jobs[job];
+    j.workers.removeAll(socket);
+    // A copy of the job running on another worker may have finished first
+    if (j.finished)
+        return;
+
+    if (success) {
+        // Failed writes are counted once they have all been flushed
+        m_io.write(j.output, output);
+        j.finished = true;
+        qInfo("Baked %s on %s in %dms", qPrintable(j.input), qPrintable(socket->peerAddress().toString()),
+              int(QDateTime::currentMSecsSinceEpoch() - j.startTime));
+    } else if (j.workers.isEmpty()) {
+        retryJob(job, log);
+    }
+    finishIfDone();
+}
+
+void BatchCoordinator::workerLost(QTcpSocket *socket)
+{
+    qInfo("Worker %s disconnected", qPrintable(socket->peerAddress().toString()));
+    int job = m_runningJob.take(socket);
+    m_idleWorkers.removeAll(socket);
+    socket->deleteLater();
+
+    if (job >= 0) {
+        Job &j = m_jobs[job];
+        j.workers.removeAll(socket);
+        if (!j.finished && j.workers.isEmpty())
+            retryJob(job, "worker disconnected");
+    }
+    finishIfDone();
+}
+
+void BatchCoordinator::retryJob(int job, const QString &reason)
+{
+    Job &j = m_jobs[job];
+    if (j.attempts < maximumAttempts) {
+        qWarning("Retrying %s after failure: %s", qPrintable(j.input), qPrintable(reason));
+        m_queue.append(job);
+        assignIdleWorkers();
+    } else {
+        qWarning("Giving up on %s after %d attempts: %s", qPrintable(j.input), j.attempts, qPrintable(reason));
+        j.finished = true;
+        m_failedJobs++;
+    }
+}
+
+void BatchCoordinator::assignJob(QTcpSocket *socket)
+{
+    if (m_runningJob.value(socket, -1) >= 0 || m_idleWorkers.contains(socket))
+        return;
+
+    int job = -1;
+    if (!m_queue.isEmpty()) {
+        job = m_queue.takeFirst();
+        m_jobs[job].attempts++;
+        m_jobs[job].startTime = QDateTime::currentMSecsSinceEpoch();
+    } else {
+        job = stragglerJob();
+    }
+
+    if (job < 0) {
+        // Keep the worker around in case a job has to be retried
+        bool done = true;
+        for (const Job &j : m_jobs)
+            done = done && j.finished;
+        if (done) {
+            QByteArray message;
+            QDataStream(&message, QIODevice::WriteOnly) << quint8(NoMoreJobsMessage);
+            sendMessage(socket, message);
+        } else {
+            m_idleWorkers.append(socket);
+        }
+        return;
+    }
+
+    for (int i = 0; i < qMin(prefetchDepth, m_queue.count()); i++)
+        m_io.prefetch(m_jobs.at(m_queue.at(i)).input);
+
+    // The worker holds on to the job while its input is being read, and gets
+    // it once the event loop hears back from the reads
+    Job &j = m_jobs[job];
+    j.workers.append(socket);
+    m_runningJob[socket] = job;
+    QPointer<QTcpSocket> worker(socket);
+    m_io.read(j.input, &m_server, [this, worker, job](bool ok, const QByteArray &input) {
+        if (worker)
+            sendJob(worker, job, ok, input);
+    });
+}
+
+void BatchCoordinator::sendJob(QTcpSocket *socket, int job, bool ok, const QByteArray &input)
+{
+    Job &j = m_jobs[job];
+    if (m_runningJob.value(socket, -1) != job)
+        return;
+
+    // Another copy of the job may have finished in the meantime
+    if (!ok || j.finished) {
+        j.workers.removeAll(socket);
+        m_runningJob[socket] = -1;
+        if (!j.finished) {
+            qWarning("Failed to open %s", qPrintable(j.input));
+            j.finished = true;
+            m_failedJobs++;
+            finishIfDone();
+        }
+        assignJob(socket);
+        return;
+    }
+
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(JobMessage) << qint32(job) << QFileInfo(j.input).fileName() << input
+           << m_bakeArguments + j.arguments << QFileInfo(j.output).suffix();
+    sendMessage(socket, message);
+}
+
+void BatchCoordinator::assignIdleWorkers()
+{
+    QList<QTcpSocket *> idleWorkers = m_idleWorkers;
+    m_idleWorkers.clear();
+    for (QTcpSocket *socket : idleWorkers)
+        assignJob(socket);
+}
+
+int BatchCoordinator::stragglerJob() const
+{
+    // The job which has been running the longest on a single worker
+    int straggler = -1;
+    for (int job = 0; job < m_jobs.count(); job++) {
+        const Job &j = m_jobs.at(job);
+        if (!j.finished && j.workers.count() == 1
+                && (straggler < 0 || j.startTime < m_jobs.at(straggler).startTime)) {
+            straggler = job;
+        }
+    }
+    return straggler;
+}
+
+void BatchCoordinator::finishIfDone()
+{
+    for (const Job &j : m_jobs) {
+        if (!j.finished)
+            return;
+    }
+
+    for (const QString &filename : m_io.flush()) {
+        qWarning("Failed to write %s", qPrintable(filename));
+        m_failedJobs++;
+    }
+
+    // Let the idle workers know, and the busy ones once they report back
+    assignIdleWorkers();
+    qInfo("Baked %d of %d jobs", m_jobs.count() - m_failedJobs, m_jobs.count());
+    QCoreApplication::exit(m_failedJobs > 0 ? 1 : 0);
+}
+
+BatchWorker::BatchWorker()
+{
+    QObject::connect(&m_socket, &QTcpSocket::readyRead, [this]() { readMessages(); });
+    QObject::connect(&m_socket, &QTcpSocket::disconnected, []() { QCoreApplication::exit(0); });
+    QObject::connect(&m_socket, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error),
+                     [this](QAbstractSocket::SocketError) {
+        if (m_socket.state() != QAbstractSocket::ConnectedState) {
+            qWarning("Lost the coordinator: %s", qPrintable(m_socket.errorString()));
+            QCoreApplication::exit(1);
+        }
+    });
+}
+
+void BatchWorker::connectToCoordinator(const QString &host, quint16 port)
+{
+    QObject::connect(&m_socket, &QTcpSocket::connected, [this]() {
+        QByteArray message;
+        QDataStream(&message, QIODevice::WriteOnly) << quint8(RequestJobMessage);
+        sendMessage(&m_socket, message);
+    });
+    m_socket.connectToHost(host, port);
+}
+
+void BatchWorker::readMessages()
+{
+    receiveMessages(&m_socket, [&](QDataStream &message) {
+        quint8 type;
+        message >> type;
+        if (type == JobMessage) {
+            qint32 job;
+            QString inputName;
+            QByteArray input;
+            QStringList bakeArguments;
+            QString outputSuffix;
+            message >> job >> inputName >> input >> bakeArguments >> outputSuffix;
+            runJob(job, inputName, input, bakeArguments, outputSuffix);
+        } else if (type == NoMoreJobsMessage) {
+            m_socket.disconnectFromHost();
+        }
+    });
+}
+
+void BatchWorker::runJob(int job, const QString &inputName, const QByteArray &input,
+                         const QStringList &bakeArguments, const QString &outputSuffix)
+{
+    // Each job gets a fresh directory, so nothing is left over from the previous one
+    m_process.reset();
+    m_workDir.reset(new QTemporaryDir);
+    QString inputFilename = m_workDir->filePath(inputName);
+    // The output keeps the suffix of the manifest's, which picks the format
+    QString outputFilename = m_workDir->filePath(QFileInfo(inputName).completeBaseName() + ".distbake."
+                                                 + (outputSuffix.isEmpty() ? QString("png") : outputSuffix));
+
+    QFile file(inputFilename);
+    if (!m_workDir->isValid() || !file.open(QIODevice::WriteOnly) || file.write(input) != input.size()) {
+        file.close();
+        jobFinished(job, QString());
+        return;
+    }
+    file.close();
+
+    // Bake in a child process, so that a crash only costs the job instead of the worker
+    m_process.reset(new QProcess);
+    m_process->setProcessChannelMode(QProcess::MergedChannels);
+    QObject::connect(m_process.get(), static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                     [this, job, outputFilename](int, QProcess::ExitStatus) {
+        jobFinished(job, outputFilename);
+    });
+    m_process->start(QCoreApplication::applicationFilePath(),
+                     QStringList(bakeArguments) << inputFilename << outputFilename);
+}
+
+void BatchWorker::jobFinished(int job, const QString &outputFilename)
+{
+    QString log = m_process ? QString::fromLocal8Bit(m_process->readAll()).trimmed() : QString();
+    bool success = m_process && m_process->exitStatus() == QProcess::NormalExit && m_process->exitCode() == 0;
+
+    // distbake prints the help and exits normally on bad arguments, so look
+    // for the output file as well
+    QByteArray output;
+    QFile file(outputFilename);
+    if (success && file.open(QIODevice::ReadOnly))
+        output = file.readAll();
+    else
+        success = false;
+    if (!success && log.isEmpty())
+        log = "failed to run distbake";
+
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(ResultMessage) << qint32(job) << success << output << log;
+    sendMessage(&m_socket, message);
+}
+
+QRect shardRect(const QSize &size, int column, int row, int columns, int rows)
+{
+    return QRect(QPoint(column * size.width() / columns, row * size.height() / rows),
+                 QPoint((column + 1) * size.width() / columns - 1, (row + 1) * size.height() / rows - 1));
+}
+
+QImage joinShards(const QVector<QImage> &shards, int columns, int rows)
+{
+    // The shards of a column share the width and those of a row the height
+    QVector<int> left(columns + 1, 0), top(rows + 1, 0);
+    for (int column = 0; column < columns; column++)
+        left[column + 1] = left.at(column) + shards.at(column).width();
+    for (int row = 0; row < rows; row++)
+        top[row + 1] = top.at(row) + shards.at(row * columns).height();
+
+    QImage image(left.at(columns), top.at(rows), QImage::Format_Grayscale8);
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            QImage shard = shards.at(row * columns + column).convertToFormat(QImage::Format_Grayscale8);
+            if (shard.size() != QSize(left.at(column + 1) - left.at(column), top.at(row + 1) - top.at(row)))
+                return QImage();
+            for (int y = 0; y < shard.height(); y++)
+                memcpy(image.scanLine(top.at(row) + y) + left.at(column), shard.constScanLine(y), shard.width());
+        }
+    }
+    return image;
+}
@@ -0,0 +1,138 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "asyncfileio.h"
+
+#include <QHash>
+#include <QHostAddress>
+#include <QImage>
+#include <QList>
+#include <QProcess>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTemporaryDir>
+#include <QTcpSocket>
+#include <QVector>
+#include <memory>
+
+// Bakes the jobs of a manifest on worker processes which connect over TCP.
+// Workers pull one job at a time, so fast workers naturally take over the
+// work slow ones would have done. Once the queue runs dry, idle workers get
+// a copy of the job which has been running the longest, and the first result
+// wins. Jobs of workers which disconnect or fail are queued again a limited
+// number of times. The inputs are sent to the workers and the resulting PNG
+// files are streamed back, so the workers don't need a shared file system.
+// The inputs of the next jobs are read ahead and the results written in the
+// background, so that slow file systems don't hold up the event loop.
+class BatchCoordinator
+{
+public:
+    // bakeArguments are passed to distbake on the workers along with the
+    // input and output file of each job
+    explicit BatchCoordinator(const QStringList &bakeArguments);
+    ~BatchCoordinator();
+
+    // Reads a manifest listing an input and an output file on each line,
+    // separated by a tab or by spaces. Empty lines and lines starting with #
+    // are skipped.
+    bool loadManifest(const QString &filename);
+
+    // Adds a job baking input into output with arguments added to the bake arguments
+    void addJob(const QString &input, const QString &output,
+                const QStringList &arguments = QStringList());
+
+    // Accepts workers connecting to the port of the given address only
+    bool listen(const QHostAddress &address, quint16 port);
+
+    // Starts worker processes on this machine connecting to the coordinator
+    void startLocalWorkers(int count);
+
+private:
+    struct Job
+    {
+        QString input;
+        QString output;
+        QStringList arguments;
+        int attempts = 0;
+        bool finished = false;
+        QList<QTcpSocket *> workers;
+        qint64 startTime = 0;
+    };
+
+    void acceptConnection();
+    void readMessages(QTcpSocket *socket);
+    void finishJob(QTcpSocket *socket, int job, bool success, const QByteArray &output,
+                   const QString &log);
+    void workerLost(QTcpSocket *socket);
+    void retryJob(int job, const QString &reason);
+    void assignJob(QTcpSocket *socket);
+    void sendJob(QTcpSocket *socket, int job, bool ok, const QByteArray &input);
+    void assignIdleWorkers();
+    int stragglerJob() const;
+    void finishIfDone();
+
+    QStringList m_bakeArguments;
+    QVector<Job> m_jobs;
+    QList<int> m_queue;
+    QHash<QTcpSocket *, int> m_runningJob;
+    QList<QTcpSocket *> m_idleWorkers;
+    QTcpServer m_server;
+    QList<QProcess *> m_localWorkers;
+    AsyncFileIO m_io;
+    int m_failedJobs;
+};
+
+// Connects to a coordinator and runs the jobs it hands out with a child
+// distbake process until there are no more of them.
+class BatchWorker
+{
+public:
+    BatchWorker();
+
+    void connectToCoordinator(const QString &host, quint16 port);
+
+private:
+    void readMessages();
+    void runJob(int job, const QString &inputName, const QByteArray &input,
+                const QStringList &bakeArguments, const QString &outputSuffix);
+    void jobFinished(int job, const QString &outputFilename);
+
+    QTcpSocket m_socket;
+    std::unique_ptr<QTemporaryDir> m_workDir;
+    std::unique_ptr<QProcess> m_process;
+};
+
+// Area of the shard in the given column and row of an image of size split
+// into columns x rows parts of nearly equal size
+QRect shardRect(const QSize &size, int column, int row, int columns, int rows);
+
+// Puts the Format_Grayscale8 shards of an image back together. The shards are
+// given row by row.
+QImage joinShards(const QVector<QImage> &shards, int columns, int rows);
+
+#endif // BATCH_H
@@ -0,0 +1,193 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+
+// Lock-free multi-producer multi-consumer queue on a ring of a fixed number
+// of slots, following Dmitry Vyukov's bounded queue. Each slot carries a
+// sequence number telling producers and consumers whose turn it is, so they
+// only contend on claiming a position. Producers wait while the queue is
+// full, which caps the items in flight between the stages it connects.
+// Waiting threads spin briefly and then sleep until the other side makes
+// progress, so idle stages don't take cores from the busy ones.
+template <typename T>
+class BoundedQueue
+{
+public:
+    // The capacity gets rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) :
+        m_closed(false),
+        m_sleepers(0),
+        m_enqueuePosition(0),
+        m_dequeuePosition(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T &&value)
+    {
+        Cell *cell;
+        size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[position & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (m_enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                            std::memory_order_relaxed))
+                    break;
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T *value)
+    {
+        Cell *cell;
+        size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[position & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+            if (difference == 0) {
+                if (m_dequeuePosition.compare_exchange_weak(position, position + 1,
+                                                            std::memory_order_relaxed))
+                    break;
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = m_dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        *value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits for a free slot
+    void push(T value)
+    {
+        wait([&]() { return tryPush(std::move(value)); });
+        wake();
+    }
+
+    // Waits for an item. Returns false once the queue has been closed and
+    // everything pushed before has been popped.
+    bool pop(T *value)
+    {
+        bool popped = false;
+        wait([&]() {
+            bool closed = m_closed.load(std::memory_order_acquire);
+            popped = tryPop(value);
+            return popped || closed;
+        });
+        if (popped)
+            wake();
+        return popped;
+    }
+
+    // Tells the consumers that nothing more is going to be pushed
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+        wake();
+    }
+
+private:
+    // Yields this many times before going to sleep
+    static const int spinCount = 64;
+
+    // Retries done() until it returns true, sleeping between the attempts
+    // once the spinning is over
+    template <typename Done>
+    void wait(Done done)
+    {
+        for (int spin = 0; spin < spinCount; spin++) {
+            if (done())
+                return;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleepers.fetch_add(1, std::memory_order_relaxed);
+        // Either the attempts below see the other side's progress, or wake()
+        // sees the sleeper and has to take the lock held until the wait
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!done())
+            m_changed.wait(lock);
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Wakes the sleeping threads after a push, a pop or closing the queue
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_changed.notify_all();
+    }
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    std::atomic<bool> m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::atomic<int> m_sleepers;
+    // Keep the positions claimed by producers and consumers on separate cache lines
+    alignas(64) std::atomic<size_t> m_enqueuePosition;
+    alignas(64) std::atomic<size_t> m_dequeuePosition;
+};
+
+#endif // BOUNDEDQUEUE_H
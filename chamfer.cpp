@@ -0,0 +1,136 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "chamfer.h"
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+// Step costs of the mask: 5 units per pixel, so that the diagonal and the
+// knight's move come out as 7 and 11
+static const int axialStep = 5;
+static const int diagonalStep = 7;
+static const int knightStep = 11;
+static const int unreached = 1 << 28;
+
+// Propagates the distances of a grid with a border of two unreached cells
+static void chamferPasses(vector<int> &distances, int width, int height)
+{
+    for (int y = 2; y < height - 2; y++) {
+        int *line = distances.data() + y * width;
+        const int *above = line - width;
+        const int *above2 = above - width;
+        for (int x = 2; x < width - 2; x++) {
+            int d = line[x];
+            d = min(d, line[x - 1] + axialStep);
+            d = min(d, above[x] + axialStep);
+            d = min(d, above[x - 1] + diagonalStep);
+            d = min(d, above[x + 1] + diagonalStep);
+            d = min(d, above[x - 2] + knightStep);
+            d = min(d, above[x + 2] + knightStep);
+            d = min(d, above2[x - 1] + knightStep);
+            d = min(d, above2[x + 1] + knightStep);
+            line[x] = d;
+        }
+    }
+
+    for (int y = height - 3; y >= 2; y--) {
+        int *line = distances.data() + y * width;
+        const int *below = line + width;
+        const int *below2 = below + width;
+        for (int x = width - 3; x >= 2; x--) {
+            int d = line[x];
+            d = min(d, line[x + 1] + axialStep);
+            d = min(d, below[x] + axialStep);
+            d = min(d, below[x + 1] + diagonalStep);
+            d = min(d, below[x - 1] + diagonalStep);
+            d = min(d, below[x + 2] + knightStep);
+            d = min(d, below[x - 2] + knightStep);
+            d = min(d, below2[x + 1] + knightStep);
+            d = min(d, below2[x - 1] + knightStep);
+            line[x] = d;
+        }
+    }
+}
+
+void chamferDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads)
+{
+    float maxDist = maxDistance(searchRadius);
+    int reach = ceil(maxDist);
+    QSize imageSize = field->size();
+    int bandHeight = qMax(64, searchRadius * 4);
+    int bandCount = (imageSize.height() + bandHeight - 1) / bandHeight;
+
+    atomic<int> nextBand(0);
+    runThreads(numThreads, [&](int) {
+        vector<int> toOutside, toInside;
+        for (int band = nextBand++; band < bandCount; band = nextBand++) {
+            // Source rows of the band plus as far above and below it as the
+            // distances reach, so that no pixel sees where its band ends
+            int firstLine = band * bandHeight;
+            int lineCount = qMin(bandHeight, imageSize.height() - firstLine);
+            int firstSourceLine = qMax(0, firstLine + searchRadius - reach);
+            int sourceLines = qMin(source.height(), firstLine + searchRadius + lineCount + reach)
+                    - firstSourceLine;
+            int width = source.width() + 4;
+            int height = sourceLines + 4;
+            toOutside.assign(width * height, unreached);
+            toInside.assign(width * height, unreached);
+            for (int y = 0; y < sourceLines; y++) {
+                const uchar *sourceLine = source.constScanLine(firstSourceLine + y);
+                int *outsideLine = toOutside.data() + (y + 2) * width + 2;
+                int *insideLine = toInside.data() + (y + 2) * width + 2;
+                for (int x = 0; x < source.width(); x++) {
+                    if (sourceLine[x] >= 128)
+                        insideLine[x] = 0;
+                    else
+                        outsideLine[x] = 0;
+                }
+            }
+
+            chamferPasses(toOutside, width, height);
+            chamferPasses(toInside, width, height);
+
+            for (int y = 0; y < lineCount; y++) {
+                const uchar *sourceLine = source.constScanLine(firstLine + y + searchRadius) + searchRadius;
+                int offset = (firstLine + y + searchRadius - firstSourceLine + 2) * width + searchRadius + 2;
+                const int *outsideLine = toOutside.data() + offset;
+                const int *insideLine = toInside.data() + offset;
+                uchar *fieldLine = field->scanLine(firstLine + y);
+                for (int x = 0; x < imageSize.width(); x++) {
+                    // Pixels at or above mid-gray measure the way out of the shape
+                    float distance = sourceLine[x] >= 128 ? -float(outsideLine[x]) / axialStep
+                                                          : float(insideLine[x]) / axialStep;
+                    fieldLine[x] = encodeDistance(distance, maxDist);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,186 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "contourdistance.h"
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <math.h>
+
+// The iso-value lies between the gray levels which the brute force search
+// counts to the different sides, so both see the same shape
+static const float threshold = 127.5f;
+
+static const int gridCellSize = 32;
+
+ContourDistanceField::ContourDistanceField(const QImage &source, float maxDist, bool negate) :
+    m_source(source),
+    m_maxDist(maxDist),
+    m_negate(negate),
+    m_grid(source.rect(), gridCellSize)
+{
+    // Marching squares over the cells spanned by four neighbouring pixel centers
+    for (int y = 0; y + 1 < source.height(); y++) {
+        const uchar *line = source.constScanLine(y);
+        const uchar *nextLine = source.constScanLine(y + 1);
+        for (int x = 0; x + 1 < source.width(); x++) {
+            float topLeft = line[x];
+            float topRight = line[x + 1];
+            float bottomRight = nextLine[x + 1];
+            float bottomLeft = nextLine[x];
+
+            bool insideTopLeft = topLeft < threshold;
+            bool insideTopRight = topRight < threshold;
+            bool insideBottomRight = bottomRight < threshold;
+            bool insideBottomLeft = bottomLeft < threshold;
+            if (insideTopLeft == insideTopRight && insideTopLeft == insideBottomRight
+                    && insideTopLeft == insideBottomLeft) {
+                continue;
+            }
+
+            qreal left = x + 0.5;
+            qreal top = y + 0.5;
+            QPointF topCrossing(left + (threshold - topLeft) / (topRight - topLeft), top);
+            QPointF rightCrossing(left + 1.0, top + (threshold - topRight) / (bottomRight - topRight));
+            QPointF bottomCrossing(left + (threshold - bottomLeft) / (bottomRight - bottomLeft), top + 1.0);
+            QPointF leftCrossing(left, top + (threshold - topLeft) / (bottomLeft - topLeft));
+
+            if (insideTopLeft == insideBottomRight && insideTopRight == insideBottomLeft) {
+                // Saddle: the average of the corners decides which diagonal is connected
+                float center = (topLeft + topRight + bottomRight + bottomLeft) / 4;
+                if ((center < threshold) == insideTopLeft) {
+                    addSegment(topCrossing, rightCrossing);
+                    addSegment(bottomCrossing, leftCrossing);
+                } else {
+                    addSegment(leftCrossing, topCrossing);
+                    addSegment(rightCrossing, bottomCrossing);
+                }
+                continue;
+            }
+
+            // Otherwise exactly two edges of the cell are crossed
+            QPointF crossings[2];
+            int count = 0;
+            if (insideTopLeft != insideTopRight)
+                crossings[count++] = topCrossing;
+            if (insideTopRight != insideBottomRight)
+                crossings[count++] = rightCrossing;
+            if (insideBottomLeft != insideBottomRight)
+                crossings[count++] = bottomCrossing;
+            if (insideTopLeft != insideBottomLeft)
+                crossings[count++] = leftCrossing;
+            addSegment(crossings[0], crossings[1]);
+        }
+    }
+}
+
+void ContourDistanceField::addSegment(const QPointF &from, const QPointF &to)
+{
+    // Only segments closer than the maximum distance affect a point
+    QRectF bounds(qMin(from.x(), to.x()) - m_maxDist, qMin(from.y(), to.y()) - m_maxDist,
+                  fabs(to.x() - from.x()) + 2 * m_maxDist, fabs(to.y() - from.y()) + 2 * m_maxDist);
+    m_grid.insert(m_segments.size(), bounds);
+    m_segments.push_back(QLineF(from, to));
+}
+
+float ContourDistanceField::sample(const QPointF &point) const
+{
+    // Bilinear interpolation between pixel centers, which agrees with the
+    // linear interpolation used for placing the contour vertices
+    qreal fx = qBound(0.0, point.x() - 0.5, qreal(m_source.width() - 1));
+    qreal fy = qBound(0.0, point.y() - 0.5, qreal(m_source.height() - 1));
+    int x0 = qMin(int(fx), m_source.width() - 2);
+    int y0 = qMin(int(fy), m_source.height() - 2);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    const uchar *line = m_source.constScanLine(y0);
+    const uchar *nextLine = m_source.constScanLine(y0 + 1);
+    float top = line[x0] + (line[x0 + 1] - line[x0]) * tx;
+    float bottom = nextLine[x0] + (nextLine[x0 + 1] - nextLine[x0]) * tx;
+    return top + (bottom - top) * ty;
+}
+
+float ContourDistanceField::distance(const QPointF &point, QPointF *gradient) const
+{
+    qreal nearest = m_maxDist;
+    QPointF nearestOffset;
+    int cell = m_grid.cellAt(point);
+    if (cell >= 0) {
+        for (int index : m_grid.items(cell)) {
+            const QLineF &segment = m_segments[index];
+            QPointF edge = segment.p2() - segment.p1();
+            QPointF offset = point - segment.p1();
+            qreal length = edge.x() * edge.x() + edge.y() * edge.y();
+            qreal t = 0.0;
+            if (length > 0.0)
+                t = qBound(0.0, (offset.x() * edge.x() + offset.y() * edge.y()) / length, 1.0);
+            QPointF toPoint = offset - edge * t;
+            qreal d = sqrt(toPoint.x() * toPoint.x() + toPoint.y() * toPoint.y());
+            if (d < nearest) {
+                nearest = d;
+                nearestOffset = toPoint;
+            }
+        }
+    }
+
+    // Distances are positive inside the shape, so the field grows towards
+    // the contour outside and away from it inside
+    bool inside = (sample(point) < threshold) != m_negate;
+    if (gradient)
+        *gradient = nearest > 0.0 && nearest < m_maxDist ? nearestOffset / nearest : QPointF();
+    if (!inside) {
+        if (gradient)
+            *gradient = -*gradient;
+        return -nearest;
+    }
+    return nearest;
+}
+
+void ContourDistanceField::render(const QRectF &sourceRect, QImage *field, int numThreads,
+                                  QImage *gradient) const
+{
+    uchar *bits = field->bits();
+    int bytesPerLine = field->bytesPerLine();
+    int width = field->width();
+    int height = field->height();
+    qreal xScale = sourceRect.width() / width;
+    qreal yScale = sourceRect.height() / height;
+
+    runThreads(numThreads, [&](int threadId) {
+        for (int y = threadId; y < height; y += numThreads) {
+            uchar *line = bits + y * bytesPerLine;
+            QRgba64 *gradientLine = gradient ? reinterpret_cast<QRgba64 *>(gradient->scanLine(y)) : nullptr;
+            qreal sourceY = sourceRect.top() + (y + 0.5) * yScale;
+            for (int x = 0; x < width; x++) {
+                QPointF point(sourceRect.left() + (x + 0.5) * xScale, sourceY);
+                QPointF direction;
+                line[x] = encodeDistance(distance(point, &direction), m_maxDist);
+                if (gradientLine)
+                    gradientLine[x] = encodeGradient(direction.x(), direction.y());
+            }
+        }
+    });
+}
@@ -0,0 +1,65 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CONTOURDISTANCE_H
+#define CONTOURDISTANCE_H
+
+#include "spatialgrid.h"
+
+#include <QImage>
+#include <QLineF>
+#include <vector>
+
+// Computes the distance field of a gray source buffer from its mid-gray
+// iso-contour. The contour is extracted with marching squares, placing the
+// vertices between pixel centers by linear interpolation, so edges are found
+// with subpixel accuracy instead of being snapped to whole pixels. Distances
+// to the contour segments are then evaluated only at the output texels.
+class ContourDistanceField
+{
+public:
+    // Extracts the contour of a Format_Grayscale8 source. Pixels darker than
+    // mid-gray are inside the shape, or lighter ones if negate is set.
+    ContourDistanceField(const QImage &source, float maxDist, bool negate);
+
+    // Evaluates the field at the texel centers of field, which covers
+    // sourceRect of the source buffer, with the shape on the high side. The
+    // gradient image, if given, must have the size of field.
+    void render(const QRectF &sourceRect, QImage *field, int numThreads,
+                QImage *gradient = nullptr) const;
+
+private:
+    void addSegment(const QPointF &from, const QPointF &to);
+    float sample(const QPointF &point) const;
+    float distance(const QPointF &point, QPointF *gradient) const;
+
+    QImage m_source;
+    float m_maxDist;
+    bool m_negate;
+    SpatialGrid m_grid;
+    std::vector<QLineF> m_segments;
+};
+
+#endif // CONTOURDISTANCE_H
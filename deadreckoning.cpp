@@ -0,0 +1,161 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "deadreckoning.h"
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+// Offset from a pixel to the nearest pixel found so far
+struct Nearest
+{
+    int dx;
+    int dy;
+
+    int squaredLength() const { return dx * dx + dy * dy; }
+};
+
+// Offset of pixels nothing has reached yet, far beyond any search radius
+static const int unreached = 1 << 14;
+
+// Takes over the nearest pixel of the neighbour at the given offset if it's
+// closer than the current one
+static inline void consider(Nearest *nearest, const Nearest &neighbour, int offsetX, int offsetY)
+{
+    Nearest candidate = { neighbour.dx + offsetX, neighbour.dy + offsetY };
+    if (candidate.squaredLength() < nearest->squaredLength())
+        *nearest = candidate;
+}
+
+// Propagates the nearest pixels through a grid with a border of one unreached cell
+static void deadReckoningPasses(vector<Nearest> &grid, int width, int height)
+{
+    for (int y = 1; y < height - 1; y++) {
+        Nearest *line = grid.data() + y * width;
+        const Nearest *above = line - width;
+        for (int x = 1; x < width - 1; x++) {
+            consider(&line[x], above[x - 1], -1, -1);
+            consider(&line[x], above[x], 0, -1);
+            consider(&line[x], above[x + 1], 1, -1);
+            consider(&line[x], line[x - 1], -1, 0);
+        }
+    }
+
+    for (int y = height - 2; y >= 1; y--) {
+        Nearest *line = grid.data() + y * width;
+        const Nearest *below = line + width;
+        for (int x = width - 2; x >= 1; x--) {
+            consider(&line[x], line[x + 1], 1, 0);
+            consider(&line[x], below[x - 1], -1, 1);
+            consider(&line[x], below[x], 0, 1);
+            consider(&line[x], below[x + 1], 1, 1);
+        }
+    }
+}
+
+void deadReckoningDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                                QImage *gradient)
+{
+    float maxDist = maxDistance(searchRadius);
+    QSize imageSize = field->size();
+    // A pixel handing on a candidate within the window of a field row lies
+    // between the two, so anything nearer to it than that candidate is
+    // within this many rows of the field row
+    int margin = searchRadius + int(ceil(maxDist)) + 1;
+    int bandHeight = qMax(64, margin * 2);
+    int bandCount = (imageSize.height() + bandHeight - 1) / bandHeight;
+    const Nearest none = { unreached, unreached };
+    const Nearest self = { 0, 0 };
+
+    atomic<int> nextBand(0);
+    runThreads(numThreads, [&](int) {
+        vector<Nearest> toOutside, toInside;
+        for (int band = nextBand++; band < bandCount; band = nextBand++) {
+            // Source rows of the band plus the margin above and below it, as
+            // far as the source reaches, so that no pixel sees where its band ends
+            int firstLine = band * bandHeight;
+            int lineCount = qMin(bandHeight, imageSize.height() - firstLine);
+            int firstSourceLine = qMax(0, firstLine + searchRadius - margin);
+            int sourceLines = qMin(source.height(), firstLine + searchRadius + lineCount + margin)
+                    - firstSourceLine;
+            int width = source.width() + 2;
+            int height = sourceLines + 2;
+            toOutside.assign(width * height, none);
+            toInside.assign(width * height, none);
+            for (int y = 0; y < sourceLines; y++) {
+                const uchar *sourceLine = source.constScanLine(firstSourceLine + y);
+                Nearest *outsideLine = toOutside.data() + (y + 1) * width + 1;
+                Nearest *insideLine = toInside.data() + (y + 1) * width + 1;
+                for (int x = 0; x < source.width(); x++) {
+                    if (sourceLine[x] >= 128)
+                        insideLine[x] = self;
+                    else
+                        outsideLine[x] = self;
+                }
+            }
+
+            deadReckoningPasses(toOutside, width, height);
+            deadReckoningPasses(toInside, width, height);
+
+            for (int y = 0; y < lineCount; y++) {
+                const uchar *sourceLine = source.constScanLine(firstLine + y + searchRadius) + searchRadius;
+                int offset = (firstLine + y + searchRadius - firstSourceLine + 1) * width + searchRadius + 1;
+                const Nearest *outsideLine = toOutside.data() + offset;
+                const Nearest *insideLine = toInside.data() + offset;
+                uchar *fieldLine = field->scanLine(firstLine + y);
+                QRgba64 *gradientLine = gradient
+                        ? reinterpret_cast<QRgba64 *>(gradient->scanLine(firstLine + y)) : nullptr;
+
+                for (int x = 0; x < imageSize.width(); x++) {
+                    bool inside = sourceLine[x] >= 128;
+                    // Pixels outside of the square the window search covers
+                    // don't count, whatever the propagation went through
+                    Nearest nearest = inside ? outsideLine[x] : insideLine[x];
+                    if (qAbs(nearest.dx) > searchRadius || qAbs(nearest.dy) > searchRadius)
+                        nearest = none;
+                    float distance = sqrt(float(nearest.squaredLength()));
+
+                    if (gradientLine) {
+                        // The field grows towards dark pixels
+                        if (distance > maxDist) {
+                            gradientLine[x] = encodeGradient(0.0, 0.0);
+                        } else {
+                            qreal dx = nearest.dx / distance;
+                            qreal dy = nearest.dy / distance;
+                            gradientLine[x] = inside ? encodeGradient(dx, dy) : encodeGradient(-dx, -dy);
+                        }
+                    }
+
+                    fieldLine[x] = encodeDistance(inside ? -distance : distance, maxDist);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,45 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DEADRECKONING_H
+#define DEADRECKONING_H
+
+#include <QImage>
+
+// Computes the field bruteForceDistanceField() does out of the same padded
+// source with dead reckoning (Grevera 2004): a forward and a backward raster
+// pass hand the nearest pixel on the other side of the threshold on from
+// neighbour to neighbour, and the distance is measured to that pixel. The
+// cost per pixel doesn't depend on the search radius, and the distances are
+// exact apart from the few pixels the propagation hands a slightly farther
+// pixel. Pixels outside of the square window of the search don't count. The
+// field is computed in bands of rows on numThreads threads, each extended far
+// enough that the bands agree along their seams.
+// If gradient is given, the direction towards the nearest pixel gets stored
+// into it as well.
+void deadReckoningDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                                QImage *gradient = nullptr);
+
+#endif // DEADRECKONING_H
@@ -0,0 +1,503 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+QImage scaleGradient(const QImage &gradient, const QSize &size, bool reverse)
+{
+    QImage scaled = gradient.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    for (int y = 0; y < scaled.height(); y++) {
+        QRgba64 *line = reinterpret_cast<QRgba64 *>(scaled.scanLine(y));
+        for (int x = 0; x < scaled.width(); x++) {
+            qreal gx = line[x].red() / 32767.5 - 1.0;
+            qreal gy = line[x].green() / 32767.5 - 1.0;
+            qreal length = sqrt(gx * gx + gy * gy);
+            if (length < 1e-3) {
+                line[x] = encodeGradient(0.0, 0.0);
+                continue;
+            }
+            if (reverse)
+                length = -length;
+            line[x] = encodeGradient(gx / length, gy / length);
+        }
+    }
+    return scaled;
+}
+
+// Calls back with each output texel overlapping the source texel at index
+// and the extent of the overlap, in output texels
+template <typename Function>
+static void forEachCovered(int index, int sourceLength, int length, Function function)
+{
+    double scale = double(length) / sourceLength;
+    double start = index * scale;
+    double end = (index + 1) * scale;
+    for (int i = int(start); i < length && i < end; i++)
+        function(i, float(qMin(end, i + 1.0) - qMax(start, double(i))));
+}
+
+FieldDownscaler::FieldDownscaler(const QSize &sourceSize, const QSize &size, bool negate, bool withGradient) :
+    m_sourceSize(sourceSize),
+    m_size(size),
+    m_negate(negate),
+    m_withGradient(withGradient),
+    m_linesAdded(0),
+    m_firstOpenRow(0)
+{
+    for (int x = 0; x < sourceSize.width(); x++) {
+        m_columnStarts.push_back(m_columns.size());
+        forEachCovered(x, sourceSize.width(), size.width(), [&](int column, float weight) {
+            m_columns.push_back(column);
+            m_columnWeights.push_back(weight);
+        });
+    }
+    m_columnStarts.push_back(m_columns.size());
+}
+
+int FieldDownscaler::coveredRow(int line) const
+{
+    // The first output row the source line covers, or the row count past the end
+    int row = m_size.height();
+    if (line < m_sourceSize.height()) {
+        forEachCovered(line, m_sourceSize.height(), m_size.height(), [&](int covered, float) {
+            row = qMin(row, covered);
+        });
+    }
+    return row;
+}
+
+void FieldDownscaler::addBand(int firstLine, const QImage &field, const QImage *gradient, int numThreads)
+{
+    int width = m_size.width();
+    int height = m_size.height();
+    int firstRow = coveredRow(firstLine);
+    int lastRow = firstRow;
+    forEachCovered(firstLine + field.height() - 1, m_sourceSize.height(), height, [&](int covered, float) {
+        lastRow = qMax(lastRow, covered + 1);
+    });
+    m_linesAdded = firstLine + field.height();
+
+    // Open the rows the band reaches
+    size_t openRows = qMax(0, lastRow - m_firstOpenRow);
+    if (m_weights.size() < openRows * width) {
+        m_sums.resize(openRows * width, 0.0f);
+        m_weights.resize(openRows * width, 0.0f);
+        if (m_withGradient)
+            m_gradientSums.resize(openRows * width * 2, 0.0f);
+    }
+
+    // Each thread owns the output rows it takes, and adds the band's lines
+    // overlapping them
+    atomic<int> nextRow(firstRow);
+    runThreads(numThreads, [&](int) {
+        for (int row = nextRow++; row < lastRow; row = nextRow++) {
+            size_t index = size_t(row - m_firstOpenRow) * width;
+            float *sums = m_sums.data() + index;
+            float *weights = m_weights.data() + index;
+            float *gradientSums = gradient && m_withGradient ? m_gradientSums.data() + index * 2 : nullptr;
+            double scale = double(m_sourceSize.height()) / height;
+            int firstY = qMax(0, int(row * scale) - firstLine);
+            int lastY = qMin(field.height(), int(ceil((row + 1) * scale)) - firstLine);
+            for (int y = firstY; y < lastY; y++) {
+                float lineWeight = 0.0f;
+                forEachCovered(firstLine + y, m_sourceSize.height(), height, [&](int covered, float weight) {
+                    if (covered == row)
+                        lineWeight = weight;
+                });
+                if (lineWeight == 0.0f)
+                    continue;
+
+                const uchar *fieldLine = field.constScanLine(y);
+                const QRgba64 *gradientLine = gradientSums
+                        ? reinterpret_cast<const QRgba64 *>(gradient->constScanLine(y)) : nullptr;
+                for (int x = 0; x < m_sourceSize.width(); x++) {
+                    for (int i = m_columnStarts[x]; i < m_columnStarts[x + 1]; i++) {
+                        int column = m_columns[i];
+                        float weight = lineWeight * m_columnWeights[i];
+                        sums[column] += fieldLine[x] * weight;
+                        weights[column] += weight;
+                        if (gradientSums) {
+                            gradientSums[column * 2] += (gradientLine[x].red() / 32767.5f - 1.0f) * weight;
+                            gradientSums[column * 2 + 1] += (gradientLine[x].green() / 32767.5f - 1.0f) * weight;
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+int FieldDownscaler::takeRows(QImage *field, QImage *gradient)
+{
+    // Rows above the first one the next line covers are complete
+    int width = m_size.width();
+    int count = coveredRow(m_linesAdded) - m_firstOpenRow;
+    *field = QImage(width, count, QImage::Format_Grayscale8);
+    if (gradient)
+        *gradient = QImage(width, count, QImage::Format_RGBA64);
+
+    for (int y = 0; y < count; y++) {
+        uchar *fieldLine = field->scanLine(y);
+        QRgba64 *gradientLine = gradient && m_withGradient
+                ? reinterpret_cast<QRgba64 *>(gradient->scanLine(y)) : nullptr;
+        for (int x = 0; x < width; x++) {
+            size_t index = size_t(y) * width + x;
+            float weight = qMax(m_weights[index], 1e-6f);
+            int value = qBound(0, int(m_sums[index] / weight + 0.5f), 255);
+            fieldLine[x] = m_negate ? 255 - value : value;
+            if (!gradientLine)
+                continue;
+
+            qreal gx = m_gradientSums[index * 2] / weight;
+            qreal gy = m_gradientSums[index * 2 + 1] / weight;
+            qreal length = sqrt(gx * gx + gy * gy);
+            if (length < 1e-3) {
+                gradientLine[x] = encodeGradient(0.0, 0.0);
+                continue;
+            }
+            if (m_negate)
+                length = -length;
+            gradientLine[x] = encodeGradient(gx / length, gy / length);
+        }
+    }
+
+    m_sums.erase(m_sums.begin(), m_sums.begin() + size_t(count) * width);
+    m_weights.erase(m_weights.begin(), m_weights.begin() + size_t(count) * width);
+    if (m_withGradient)
+        m_gradientSums.erase(m_gradientSums.begin(), m_gradientSums.begin() + size_t(count) * width * 2);
+    m_firstOpenRow += count;
+    return count;
+}
+
+void bruteForceDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                             QImage *gradient)
+{
+    int kernelDim = searchRadius * 2 + 1;
+
+    // Setup search kernel look-up table
+    int center = searchRadius;
+    shared_ptr<float> searchKernel(new float[kernelDim * kernelDim]);
+
+    int x = 0, y = 0;
+    for (int i = 0; i < kernelDim * kernelDim; i++) {
+        int dx = x - center; int dy = y - center;
+        searchKernel.get()[i] = sqrt(dx * dx + dy *dy);
+        x++;
+        if ((i + 1)% kernelDim == 0) {
+            y++;
+            x = 0;
+        }
+    }
+
+    float maxDist = maxDistance(searchRadius);
+    QSize imageSize = field->size();
+    int imageScanlineLength = source.bytesPerLine();
+    const float* kernelPtr = searchKernel.get();
+
+    auto calculateDistance = [&](int interleave, int lineStride) {
+        for (int y = interleave; y < imageSize.height(); y += lineStride) {
+            const uchar* imageLine = source.constScanLine(y);
+            uchar* fieldLine = field->scanLine(y);
+            QRgba64 *gradientLine = gradient ? reinterpret_cast<QRgba64 *>(gradient->scanLine(y)) : nullptr;
+
+            for (int x = 0; x < imageSize.width(); x++) {
+                int kernelIndex = 0;
+                int nearest = -1;
+                bool inside = imageLine[x + center + center * imageScanlineLength] >= 128;
+                float minDistance = 1e6;
+
+                for (int j = 0; j < kernelDim; j++) {
+                    for (int i = 0; i < kernelDim; i++) {
+                        unsigned char px = imageLine[x + i + j * imageScanlineLength];
+                        if (((inside && px < 128) || (!inside && px >= 128))
+                                && kernelPtr[kernelIndex] < minDistance) {
+                            minDistance = kernelPtr[kernelIndex];
+                            nearest = kernelIndex;
+                        }
+                        kernelIndex++;
+                    }
+                }
+
+                if (gradientLine) {
+                    // The field grows towards dark pixels
+                    if (nearest < 0 || minDistance > maxDist) {
+                        *gradientLine++ = encodeGradient(0.0, 0.0);
+                    } else {
+                        qreal dx = (nearest % kernelDim - center) / minDistance;
+                        qreal dy = (nearest / kernelDim - center) / minDistance;
+                        *gradientLine++ = inside ? encodeGradient(dx, dy) : encodeGradient(-dx, -dy);
+                    }
+                }
+
+                if (minDistance > maxDist)
+                    minDistance = maxDist;
+
+                if (inside)
+                    minDistance = -minDistance;
+
+                *fieldLine++ = encodeDistance(minDistance, maxDist);
+            }
+        }
+    };
+
+    runThreads(numThreads, [&](int threadId) {
+        calculateDistance(threadId, numThreads);
+    });
+}
+
+void summedAreaDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                             QImage *gradient)
+{
+    float maxDist = maxDistance(searchRadius);
+    QSize imageSize = field->size();
+    int bandHeight = qMax(64, searchRadius * 4);
+    int bandCount = (imageSize.height() + bandHeight - 1) / bandHeight;
+
+    atomic<int> nextBand(0);
+    runThreads(numThreads, [&](int) {
+        // Number of pixels at or above mid-gray above and to the left of each
+        // corner of the band's source rows
+        vector<int> table;
+        for (int band = nextBand++; band < bandCount; band = nextBand++) {
+            int firstLine = band * bandHeight;
+            int lineCount = qMin(bandHeight, imageSize.height() - firstLine);
+            int sourceLines = lineCount + searchRadius * 2;
+            int stride = source.width() + 1;
+            table.assign(stride * (sourceLines + 1), 0);
+            for (int y = 0; y < sourceLines; y++) {
+                const uchar *sourceLine = source.constScanLine(firstLine + y);
+                const int *above = table.data() + y * stride;
+                int *line = table.data() + (y + 1) * stride;
+                int count = 0;
+                for (int x = 0; x < source.width(); x++) {
+                    count += sourceLine[x] >= 128;
+                    line[x + 1] = above[x + 1] + count;
+                }
+            }
+
+            for (int y = 0; y < lineCount; y++) {
+                int sourceY = y + searchRadius;
+                const uchar *sourceLine = source.constScanLine(firstLine + sourceY);
+                uchar *fieldLine = field->scanLine(firstLine + y);
+                QRgba64 *gradientLine = gradient
+                        ? reinterpret_cast<QRgba64 *>(gradient->scanLine(firstLine + y)) : nullptr;
+
+                for (int x = 0; x < imageSize.width(); x++) {
+                    int sourceX = x + searchRadius;
+                    bool inside = sourceLine[sourceX] >= 128;
+
+                    // Whether the window reaching radius pixels from the pixel
+                    // holds a pixel on the other side
+                    auto windowHasOther = [&](int radius) {
+                        const int *top = table.data() + (sourceY - radius) * stride;
+                        const int *bottom = table.data() + (sourceY + radius + 1) * stride;
+                        int left = sourceX - radius, right = sourceX + radius + 1;
+                        int count = bottom[right] - bottom[left] - top[right] + top[left];
+                        return inside ? count < (radius * 2 + 1) * (radius * 2 + 1) : count > 0;
+                    };
+
+                    int nearestDx = 0, nearestDy = 0;
+                    int nearestSquared = -1;
+                    if (windowHasOther(searchRadius)) {
+                        int low = 1, high = searchRadius;
+                        while (low < high) {
+                            int radius = (low + high) / 2;
+                            if (windowHasOther(radius))
+                                high = radius;
+                            else
+                                low = radius + 1;
+                        }
+
+                        // The nearest pixel lies on a ring at least as far
+                        // out as the window found, and rings farther out than
+                        // the best distance so far can't hold a nearer one.
+                        // Of pixels at the same distance the first one in
+                        // row order wins, like in the brute force search.
+                        for (int ring = low; ring <= searchRadius; ring++) {
+                            if (nearestSquared >= 0 && ring * ring > nearestSquared)
+                                break;
+                            for (int dy = -ring; dy <= ring; dy++) {
+                                const uchar *ringLine = source.constScanLine(firstLine + sourceY + dy);
+                                int step = dy == -ring || dy == ring ? 1 : ring * 2;
+                                for (int dx = -ring; dx <= ring; dx += step) {
+                                    bool other = (ringLine[sourceX + dx] >= 128) != inside;
+                                    int squared = dx * dx + dy * dy;
+                                    bool nearer = nearestSquared < 0 || squared < nearestSquared
+                                            || (squared == nearestSquared
+                                                && (dy < nearestDy || (dy == nearestDy && dx < nearestDx)));
+                                    if (other && nearer) {
+                                        nearestSquared = squared;
+                                        nearestDx = dx;
+                                        nearestDy = dy;
+                                    }
+                                }
+                            }
+                        }
+                    }
+
+                    float minDistance = nearestSquared < 0 ? maxDist : sqrt(float(nearestSquared));
+                    if (gradientLine) {
+                        // The field grows towards dark pixels
+                        if (nearestSquared < 0 || minDistance > maxDist) {
+                            gradientLine[x] = encodeGradient(0.0, 0.0);
+                        } else {
+                            qreal dx = nearestDx / minDistance;
+                            qreal dy = nearestDy / minDistance;
+                            gradientLine[x] = inside ? encodeGradient(dx, dy) : encodeGradient(-dx, -dy);
+                        }
+                    }
+
+                    fieldLine[x] = encodeDistance(inside ? -minDistance : minDistance, maxDist);
+                }
+            }
+        }
+    });
+}
+
+void coherentDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                           QImage *gradient)
+{
+    float maxDist = maxDistance(searchRadius);
+    QSize imageSize = field->size();
+    int stride = source.bytesPerLine();
+    int radius = searchRadius;
+
+    runThreads(numThreads, [&](int threadId) {
+        for (int y = threadId; y < imageSize.height(); y += numThreads) {
+            // The pixel being computed is at center[x]
+            const uchar *center = source.constScanLine(y + radius) + radius;
+            uchar *fieldLine = field->scanLine(y);
+            QRgba64 *gradientLine = gradient ? reinterpret_cast<QRgba64 *>(gradient->scanLine(y)) : nullptr;
+
+            bool previousInside = false;
+            int nearestDx = 0, nearestDy = 0;
+            int nearestSquared = -1;
+
+            for (int x = 0; x < imageSize.width(); x++) {
+                bool inside = center[x] >= 128;
+                // Of pixels at the same distance the first one in row order
+                // wins, like in the brute force search
+                auto visit = [&](int dx, int dy) {
+                    int squared = dx * dx + dy * dy;
+                    bool nearer = nearestSquared < 0 || squared < nearestSquared
+                            || (squared == nearestSquared
+                                && (dy < nearestDy || (dy == nearestDy && dx < nearestDx)));
+                    if (nearer && (center[x + dx + dy * stride] >= 128) != inside) {
+                        nearestSquared = squared;
+                        nearestDx = dx;
+                        nearestDy = dy;
+                    }
+                };
+
+                if (x == 0) {
+                    nearestSquared = -1;
+                    for (int dy = -radius; dy <= radius; dy++) {
+                        for (int dx = -radius; dx <= radius; dx++)
+                            visit(dx, dy);
+                    }
+                } else if (inside != previousInside) {
+                    // The left neighbour is on the other side, and only the
+                    // one above comes before it
+                    bool above = (center[x - stride] >= 128) != inside;
+                    nearestDx = above ? 0 : -1;
+                    nearestDy = above ? -1 : 0;
+                    nearestSquared = 1;
+                } else if (nearestSquared < 0) {
+                    // Only the column entering the window can hold anything
+                    for (int dy = -radius; dy <= radius; dy++)
+                        visit(radius, dy);
+                } else {
+                    // Nothing on the other side can be nearer than the previous
+                    // distance less one, unless it just entered the window
+                    float low = sqrt(float(nearestSquared)) - 1.0f;
+                    int highSquared = 2 * radius * radius;
+                    if (nearestDx - 1 >= -radius) {
+                        nearestDx--;
+                        nearestSquared = nearestDx * nearestDx + nearestDy * nearestDy;
+                        highSquared = nearestSquared;
+                    } else {
+                        nearestSquared = -1;
+                    }
+
+                    for (int dy = -radius; dy <= radius; dy++)
+                        visit(radius, dy);
+
+                    for (int dy = -radius; dy <= radius; dy++) {
+                        int outer = highSquared - dy * dy;
+                        if (outer < 0)
+                            continue;
+                        float inner = low > 0.0f ? low * low - dy * dy : 0.0f;
+                        int first = inner > 0.0f ? int(sqrt(inner)) : 0;
+                        int last = qMin(radius, int(sqrt(float(outer))));
+                        for (int dx = first; dx <= last; dx++) {
+                            visit(dx, dy);
+                            if (dx > 0)
+                                visit(-dx, dy);
+                        }
+                    }
+                }
+                previousInside = inside;
+
+                float minDistance = nearestSquared < 0 ? maxDist : sqrt(float(nearestSquared));
+                if (gradientLine) {
+                    // The field grows towards dark pixels
+                    if (nearestSquared < 0 || minDistance > maxDist) {
+                        gradientLine[x] = encodeGradient(0.0, 0.0);
+                    } else {
+                        qreal dx = nearestDx / minDistance;
+                        qreal dy = nearestDy / minDistance;
+                        gradientLine[x] = inside ? encodeGradient(dx, dy) : encodeGradient(-dx, -dy);
+                    }
+                }
+
+                fieldLine[x] = encodeDistance(inside ? -minDistance : minDistance, maxDist);
+            }
+        }
+    });
+}
+
+void compareFields(const QImage &a, const QImage &b, int *differing, int *largest)
+{
+    *differing = 0;
+    *largest = 0;
+    for (int y = 0; y < a.height(); y++) {
+        const uchar *lineA = a.constScanLine(y);
+        const uchar *lineB = b.constScanLine(y);
+        for (int x = 0; x < a.width(); x++) {
+            int difference = qAbs(lineA[x] - lineB[x]);
+            if (difference) {
+                ++*differing;
+                *largest = qMax(*largest, difference);
+            }
+        }
+    }
+}
@@ -0,0 +1,133 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <QImage>
+#include <QRgba64>
+#include <math.h>
+#include <vector>
+
+// Distances are measured in source image pixels, clamped to the maximum distance
+// of the search radius and mapped [-maxDistance, maxDistance] => [0, 255].
+inline float maxDistance(int searchRadius)
+{
+    return sqrt(2.0f * searchRadius * searchRadius);
+}
+
+inline uchar encodeDistance(float distance, float maxDist)
+{
+    if (distance > maxDist)
+        distance = maxDist;
+    else if (distance < -maxDist)
+        distance = -maxDist;
+    return ((distance / maxDist) + 1.0) * 0.5 * 255;
+}
+
+// Gradients are unit vectors pointing towards increasing field values, mapped
+// [-1, 1] => [0, 65535] into the red and green channels of a Format_RGBA64
+// image. Texels without an edge within the maximum distance get a zero vector.
+inline QRgba64 encodeGradient(qreal x, qreal y)
+{
+    return QRgba64::fromRgba64((x + 1.0) * 0.5 * 65535 + 0.5, (y + 1.0) * 0.5 * 65535 + 0.5,
+                               0, 65535);
+}
+
+// Scales a gradient image to size and makes the vectors unit length again.
+// If reverse is set the vectors are also flipped, which is what inverting the
+// pixels of the distance field does to its gradient.
+QImage scaleGradient(const QImage &gradient, const QSize &size, bool reverse);
+
+// Scales a field computed band by band to size, averaging the source texels
+// each output texel covers as the bands come in, so that the field never
+// exists at the source resolution as a whole. Output rows are handed out as
+// soon as the last band they cover has been added and only the rows still
+// open are kept. If negate is set the field is inverted and the gradient
+// flipped.
+class FieldDownscaler
+{
+public:
+    FieldDownscaler(const QSize &sourceSize, const QSize &size, bool negate, bool withGradient);
+
+    // Adds the rows of the source field starting at firstLine. The bands
+    // have to come in from top to bottom.
+    void addBand(int firstLine, const QImage &field, const QImage *gradient, int numThreads);
+    // Moves the output rows finished so far into field and gradient, which
+    // get as many rows, and returns their count
+    int takeRows(QImage *field, QImage *gradient);
+
+private:
+    int coveredRow(int line) const;
+
+    QSize m_sourceSize;
+    QSize m_size;
+    bool m_negate;
+    bool m_withGradient;
+    // Source lines added so far and the first output row not handed out
+    int m_linesAdded;
+    int m_firstOpenRow;
+    // Output texels each source column covers, with the width covered
+    std::vector<int> m_columnStarts;
+    std::vector<int> m_columns;
+    std::vector<float> m_columnWeights;
+    // Sums of the open rows from m_firstOpenRow on
+    std::vector<float> m_sums;
+    std::vector<float> m_weights;
+    std::vector<float> m_gradientSums;
+};
+
+// Computes the distance field of a Format_Grayscale8 source image padded with
+// searchRadius pixels on each side by searching the whole neighbourhood of every
+// pixel for a pixel on the other side of the mid-gray threshold. Pixels darker
+// than mid-gray get positive distances. The field has the size of the unpadded
+// source. If gradient is given, the direction towards the nearest pixel found
+// gets stored into it as well.
+void bruteForceDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                             QImage *gradient = nullptr);
+
+// Computes the same field as bruteForceDistanceField(), but first finds the
+// smallest square window around each pixel holding a pixel on the other side
+// by bisection, counting the pixels of a window in constant time with a
+// summed-area table of the thresholded source. Only the rings of the window
+// which can still hold a nearer pixel are searched pixel by pixel, so pixels
+// far from any edge cost a logarithmic number of window tests. The table is
+// built for bands of rows at a time to bound the memory use.
+void summedAreaDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                             QImage *gradient = nullptr);
+
+// Computes the same field as bruteForceDistanceField(), but carries the
+// nearest pixel found for one pixel over to its right neighbour. A neighbour
+// on the other side is at distance 1, and otherwise the distance of the next
+// pixel differs by at most one, so only the annulus of that width around it
+// and the column newly entering the window need to be searched.
+void coherentDistanceField(const QImage &source, int searchRadius, QImage *field, int numThreads,
+                           QImage *gradient = nullptr);
+
+// Compares two Format_Grayscale8 fields of the same size, storing the number
+// of texels which differ and the largest difference between them.
+void compareFields(const QImage &a, const QImage &b, int *differing, int *largest);
+
+#endif // DISTANCEFIELD_H
@@ -1,11 +1,60 @@
-QT += core gui svg
+QT += core gui svg network
 
 TARGET = distbake
 CONFIG += console c++11
 CONFIG -= app_bundle
 TEMPLATE = app
 
-SOURCES += main.cpp
+SOURCES += main.cpp \
+    asyncfileio.cpp \
+    batch.cpp \
+    chamfer.cpp \
+    contourdistance.cpp \
+    deadreckoning.cpp \
+    distancefield.cpp \
+    featuresize.cpp \
+    fieldio.cpp \
+    layers.cpp \
+    rasterizer.cpp \
+    reconstruction.cpp \
+    runlength.cpp \
+    sdfcodec.cpp \
+    service.cpp \
+    shape.cpp \
+    shaperecorder.cpp \
+    sparse.cpp \
+    spatialgrid.cpp \
+    sprites.cpp \
+    strokedistance.cpp \
+    svgstreamreader.cpp \
+    tiles.cpp
+
+HEADERS += \
+    asyncfileio.h \
+    batch.h \
+    boundedqueue.h \
+    chamfer.h \
+    contourdistance.h \
+    deadreckoning.h \
+    distancefield.h \
+    featuresize.h \
+    fieldio.h \
+    layers.h \
+    messages.h \
+    parallel.h \
+    rasterizer.h \
+    reconstruction.h \
+    runlength.h \
+    sdfcodec.h \
+    service.h \
+    shape.h \
+    shaperecorder.h \
+    sparse.h \
+    spatialgrid.h \
+    sprites.h \
+    strokedistance.h \
+    svgstreamreader.h \
+    tiles.h
 
 DISTFILES += \
     tester.qml
@@ -0,0 +1,55 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "featuresize.h"
+
+#include <limits>
+
+static inline void addFeature(qreal *minimum, qreal size)
+{
+    // Zero sized features don't draw anything
+    if (size > 0.0 && size < *minimum)
+        *minimum = size;
+}
+
+qreal minimumFeatureSize(const QVector<Shape> &shapes)
+{
+    qreal minimum = std::numeric_limits<qreal>::infinity();
+    for (const Shape &shape : shapes) {
+        if (shape.stroke.width > 0.0) {
+            // The outline of a stroke runs along both sides of the centerline,
+            // so only its width tells how thin it is
+            addFeature(&minimum, shape.stroke.width);
+            continue;
+        }
+
+        addFeature(&minimum, qMin(shape.bounds.width(), shape.bounds.height()));
+        for (const QPolygonF &polygon : shape.polygons) {
+            QRectF bounds = polygon.boundingRect();
+            addFeature(&minimum, qMin(bounds.width(), bounds.height()));
+        }
+    }
+    return minimum;
+}
@@ -0,0 +1,71 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fieldio.h"
+#include "sdfcodec.h"
+#include "sparse.h"
+#include "tiles.h"
+
+#include <QSaveFile>
+#include <vector>
+
+using namespace std;
+
+bool saveField(const QImage &field, const QString &filename, int numThreads)
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    if (filename.endsWith(".sdf", Qt::CaseInsensitive)) {
+        vector<unsigned char> data = encodeDistanceField(field.constBits(), field.width(), field.height(),
+                                                         field.bytesPerLine(), numThreads);
+        if (file.write(reinterpret_cast<const char *>(data.data()), data.size()) != qint64(data.size()))
+            return false;
+    } else if (!field.save(&file, "png")) {
+        return false;
+    }
+    return file.commit();
+}
+
+bool writeField(const QImage &field, const QString &filename, int tileSize, int sparseTileSize,
+                int numThreads)
+{
+    if (sparseTileSize > 0) {
+        if (!SparseField::fromImage(field, sparseTileSize).save(filename)) {
+            qWarning("Failed to save %s", qPrintable(filename));
+            return false;
+        }
+    } else if (tileSize > 0) {
+        if (!writeTilePyramid(field, filename, tileSize, numThreads)) {
+            qWarning("Failed to write all tiles into %s", qPrintable(filename));
+            return false;
+        }
+    } else if (!saveField(field, filename, numThreads)) {
+        qWarning("Failed to save %s", qPrintable(filename));
+        return false;
+    }
+    return true;
+}
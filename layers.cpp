@@ -0,0 +1,72 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "layers.h"
+#include "rasterizer.h"
+
+LayerMasks::LayerMasks(Key key, const QSize &size, bool usePainter, int numThreads) :
+    m_key(key),
+    m_size(size),
+    m_usePainter(usePainter),
+    m_numThreads(numThreads)
+{
+}
+
+QString LayerMasks::layerName(const Shape &shape) const
+{
+    if (m_key == ByColor)
+        return QString::number(shape.color & 0xffffff, 16).rightJustified(6, '0');
+    return shape.layer.isEmpty() ? QString("ungrouped") : shape.layer;
+}
+
+void LayerMasks::add(const QVector<Shape> &shapes)
+{
+    // Group the batch by layer, keeping the painting order within each layer
+    QVector<QVector<Shape> > layerShapes(m_masks.count());
+    for (const Shape &shape : shapes) {
+        QString name = layerName(shape);
+        int layer = m_names.indexOf(name);
+        if (layer < 0) {
+            layer = m_names.count();
+            m_names.append(name);
+            m_masks.append(QImage(m_size, QImage::Format_Grayscale8));
+            m_masks.last().fill(Qt::white);
+            layerShapes.append(QVector<Shape>());
+        }
+
+        Shape mask = shape;
+        mask.color = qRgb(0, 0, 0);
+        layerShapes[layer].append(mask);
+    }
+
+    for (int layer = 0; layer < layerShapes.count(); layer++) {
+        if (layerShapes.at(layer).isEmpty())
+            continue;
+        if (m_usePainter)
+            paintShapes(layerShapes.at(layer), &m_masks[layer], m_numThreads);
+        else
+            rasterizeShapes(layerShapes.at(layer), &m_masks[layer], m_numThreads);
+    }
+}
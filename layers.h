@@ -0,0 +1,70 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include "shape.h"
+
+#include <QImage>
+#include <QStringList>
+#include <QVector>
+
+// Splits the shapes of a document into layers and rasterizes each layer into
+// a mask of its own, so that one pass over the input yields the sources of
+// all the per-layer distance fields. Shapes can be added in batches as they
+// get parsed.
+class LayerMasks
+{
+public:
+    enum Key {
+        // Shapes of the same color form a layer
+        ByColor,
+        // Shapes under the same top level element of the document form a layer
+        ByElement
+    };
+
+    // Masks are Format_Grayscale8 images of size, and the layers get drawn
+    // black on white with the scanline or the QPainter rasterizer.
+    LayerMasks(Key key, const QSize &size, bool usePainter, int numThreads);
+
+    void add(const QVector<Shape> &shapes);
+
+    int count() const { return m_masks.count(); }
+    QString name(int layer) const { return m_names.at(layer); }
+    const QImage &mask(int layer) const { return m_masks.at(layer); }
+
+private:
+    QString layerName(const Shape &shape) const;
+
+    Key m_key;
+    QSize m_size;
+    bool m_usePainter;
+    int m_numThreads;
+    QStringList m_names;
+    QVector<QImage> m_masks;
+};
+
+#endif // LAYERS_H
@@ -23,32 +23,131 @@
 -- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "batch.h"
+#include "boundedqueue.h"
+#include "chamfer.h"
+#include "contourdistance.h"
+#include "deadreckoning.h"
+#include "distancefield.h"
+#include "featuresize.h"
+#include "fieldio.h"
+#include "layers.h"
+#include "parallel.h"
+#include "reconstruction.h"
+#include "runlength.h"
+#include "rasterizer.h"
+#include "sdfcodec.h"
+#include "service.h"
+#include "shaperecorder.h"
+#include "sparse.h"
+#include "sprites.h"
+#include "strokedistance.h"
+#include "svgstreamreader.h"
+#include "tiles.h"
+
 #include <QCoreApplication>
 #include <QSvgRenderer>
 #include <QImage>
+#include <QImageReader>
 #include <QPainter>
 #include <QDebug>
 #include <QElapsedTimer>
 #include <QCommandLineParser>
-#include <memory>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <atomic>
 #include <math.h>
+#include <string.h>
 #include <thread>
+#include <vector>
 
 using namespace std;
 
+// Number of shapes the streaming parser hands to the rasterizer at a time
+static const int streamBatchSize = 4096;
+
+// Limits of the automatically picked source size. Features have to cover a
+// couple of pixels to survive rasterization against the mid-gray threshold.
+static const int defaultSourceSize = 3000;
+static const int minimumSourceSize = 64;
+static const int maximumSourceSize = 16384;
+static const qreal minimumFeaturePixels = 2.0;
+
+// Source pixels per output texel along the long edge of a draft bake
+static const int draftSourceScale = 4;
+
+// Edge of the tiles the adaptive rasterizer renders at full resolution
+static const int adaptiveTileSize = 32;
+
+// Turns the options given on the command line back into arguments, leaving
+// out the excluded ones
+static QStringList optionArguments(const QCommandLineParser &cmdLine, const QStringList &excluded)
+{
+    QStringList arguments;
+    for (const QString &name : cmdLine.optionNames()) {
+        if (excluded.contains(name))
+            continue;
+        QString option = (name.length() == 1 ? "-" : "--") + name;
+        QStringList values = cmdLine.values(name);
+        if (values.isEmpty())
+            arguments << option;
+        for (const QString &value : values)
+            arguments << option << value;
+    }
+    return arguments;
+}
+
+// Collects the shapes of the whole SVG rendered into bounds of a source buffer
+// of the given size, with the stream parser or by recording what QSvgRenderer
+// paints, and appends them to shapes. Returns false if the SVG uses features
+// which can't be recorded as shapes, in which case only some of them are there.
+static bool loadShapes(SvgStreamReader *streamReader, QSvgRenderer *svg, bool stream,
+                       const QRectF &bounds, const QSize &size, QVector<Shape> *shapes)
+{
+    if (stream) {
+        streamReader->setTargetRect(bounds);
+        while (streamReader->readShapes(shapes, streamBatchSize)) {}
+        if (streamReader->hasError())
+            qWarning("Error while parsing the SVG: %s", qPrintable(streamReader->errorString()));
+        return true;
+    }
+
+    ShapeRecorder recorder(size);
+    QPainter recordingPainter(&recorder);
+    svg->render(&recordingPainter, bounds);
+    recordingPainter.end();
+    *shapes += recorder.shapes();
+    return recorder.isComplete();
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
 
     QCommandLineParser cmdLine;
-    cmdLine.setApplicationDescription("distbake generates distance fields out of SVG images");
+    cmdLine.setApplicationDescription("distbake generates distance fields out of SVG and bitmap images");
     cmdLine.addHelpOption();
     cmdLine.addOption(QCommandLineOption(
                           "sourcesize",
                           "The length of the longer edge of the image the SVG gets rasterized "
                           "to measured in pixels. A larger size produces higher quality "
-                          "output, but increases processing time. The default value is 3000.",
+                          "output, but increases processing time. Bitmap inputs are used at their "
+                          "own size unless this option is given. \"auto\" picks the smallest size "
+                          "which resolves the thinnest strokes and smallest shapes of the SVG and "
+                          "keeps the distance error within maxerror, and scales maxdist as if it "
+                          "was given for the default size. The default value is 3000.",
                           "size", "3000"));
+    cmdLine.addOption(QCommandLineOption(
+                          "maxerror",
+                          "The largest distance error measured in output texels which the automatic "
+                          "source size may cause. Only used with --sourcesize=auto and --targetsize. "
+                          "The default value is 0.25.",
+                          "texels", "0.25"));
     cmdLine.addOption(QCommandLineOption(
                           "maxdist",
                           "The maximum distance measured in source image pixels which the "
@@ -66,9 +165,17 @@ int main(int argc, char *argv[])
                           "The length of the longer edge of the distance field output. The smaller the "
                           "outputsize gets, the more detail is lost. Also when rendering sharp corners "
                           "aren't preserved if scaled larger than targetsize. By default the targetsize "
-                          "is 1/16th of the sourcesize.",
+                          "is 1/16th of the sourcesize. \"auto\" bakes the field at growing sizes, "
+                          "renders the shape back out of each like tester.qml does at several display "
+                          "scales and picks the smallest size which stays within maxdisplayerror.",
                           "size"
                           ));
+    cmdLine.addOption(QCommandLineOption(
+                          "maxdisplayerror",
+                          "The error budget of --targetsize=auto: the mean displacement of the edges "
+                          "of the reconstructed shape, measured in display pixels when the field is "
+                          "shown at the source size and at its half and quarter. The default value is 0.5.",
+                          "pixels", "0.5"));
     cmdLine.addOption(QCommandLineOption(
                           QStringList() << "threads" << "t",
                           "Force the program to use a certain number of threads. By default the number is"
@@ -81,26 +188,437 @@ int main(int argc, char *argv[])
                           "the source image are inside the shape. If negate option is given white (or "
                           "lighter than mid-gray) colors are assumed to be inside the shape."
                       ));
+    cmdLine.addOption(QCommandLineOption(
+                          "rasterizer",
+                          "Selects how the SVG gets rasterized into the source buffer. Both "
+                          "rasterizers work on tiles in parallel. \"scanline\" uses the built-in "
+                          "coverage rasterizer, \"qpainter\" fills the tiles with QPainter. Inputs "
+                          "which can't be split into tiles (images, gradients, clipping) are always "
+                          "rendered with QSvgRenderer as a whole. \"adaptive\" rasterizes only the "
+                          "tiles along the edges at full resolution and keeps the source as "
+                          "runs, which the runs search reads directly, so very large source "
+                          "sizes fit in memory. It implies --search=runs and is only available "
+                          "with the bruteforce algorithm at exact quality, without layers, "
+                          "sprites, sparse output, progressive previews, the automatic target "
+                          "size or --savesource. Bitmaps and SVGs which can't be split into "
+                          "tiles fall back to scanline. The default value is scanline.",
+                          "name", "scanline"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "parser",
+                          "Selects how the SVG gets parsed. \"qsvg\" uses QSvgRenderer which supports "
+                          "the SVG Tiny feature set. \"stream\" reads the paths and basic shapes "
+                          "of the document incrementally with bounded memory use, which suits huge "
+                          "map and CAD exports. It ignores references, gradients and text. The "
+                          "default value is qsvg.",
+                          "name", "qsvg"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "algorithm",
+                          "Selects how the distances get computed. \"bruteforce\" searches the "
+                          "neighbourhood of every source pixel. \"stroke\" computes the distances "
+                          "to stroked paths analytically from their centerlines at the output texels "
+                          "only, without rasterizing anything. It works on SVGs made of solid, "
+                          "undashed strokes and falls back to bruteforce for anything else. "
+                          "\"contour\" extracts the outline of the source buffer with subpixel "
+                          "accuracy and measures the distances to it at the output texels, which "
+                          "gives accurate fields out of moderately sized sources and bitmaps. "
+                          "\"deadreckoning\" hands the nearest pixel on the other side of the edge "
+                          "on from neighbour to neighbour in two passes over the source buffer, at "
+                          "a cost independent of maxdist. Compared with bruteforce about 1% of the "
+                          "texels within maxdist of an edge come out up to a pixel too far, and the "
+                          "mean error is around 0.01 pixels. The default value is bruteforce.",
+                          "name", "bruteforce"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "search",
+                          "Selects how the bruteforce algorithm finds the nearest pixel on the other "
+                          "side of the edge. \"window\" visits the whole neighbourhood of every "
+                          "pixel. \"summedarea\" narrows the distance down by bisection with window "
+                          "tests on a summed-area table and only visits the rings of pixels which "
+                          "can still hold the nearest one. \"coherent\" starts from the nearest "
+                          "pixel of the left neighbour and only visits the annulus one pixel wide "
+                          "on either side of its distance. \"runs\" stores the thresholded source "
+                          "as the transitions of each row, finds the nearest pixels within each "
+                          "row from them and combines the rows in a second pass. All give the "
+                          "same distances. The default value is window.",
+                          "mode", "window"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "quality",
+                          "\"exact\" measures Euclidean distances. \"draft\" approximates them with "
+                          "a 5-7-11 chamfer transform, which deviates from them by at most 2% in "
+                          "either direction, and "
+                          "rasterizes the source at four times the target size unless --sourcesize "
+                          "is given, scaling maxdist along. Draft bakes of typical icons take a "
+                          "few milliseconds. Only available with the bruteforce algorithm and "
+                          "without gradients or the automatic target size. The default value is exact.",
+                          "level", "exact"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "gradient",
+                          "Also save the direction in which the distance field grows as a PNG file "
+                          "of the same size. The red and green channels hold the x and y components "
+                          "of the unit vector mapped [-1..1] => [0..max]. Texels farther than the "
+                          "maximum distance from any edge get a zero vector.",
+                          "filename"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "gradientbits",
+                          "The number of bits per channel in the gradient output, either 8 or 16. "
+                          "The default value is 8.",
+                          "bits", "8"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "layers",
+                          "Split the SVG into layers and generate a distance field for each of them "
+                          "out of a single pass over the input. \"color\" puts the shapes of each "
+                          "fill or stroke color into a layer of their own, \"element\" the shapes "
+                          "under each top level element of the document, named by its id (needs the "
+                          "stream parser). Up to four layers are stored into the red, green, blue "
+                          "and alpha channels of the output in the order they appear in the "
+                          "document. Layers are always computed with the contour or bruteforce "
+                          "algorithm, and the negate and gradient options are ignored for them.",
+                          "key"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "layerfiles",
+                          "Save each layer into a file of its own named after the output file and "
+                          "the layer, like output_ff0000.png, instead of the channels of one file. "
+                          "This is always done if there are more than four layers."
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "sprites",
+                          "Treat the SVG as a sprite sheet: every top level element with an id is "
+                          "baked into a distance field of its own, saved as output_id.png. The "
+                          "document is parsed once with the stream parser and the sprites are "
+                          "distributed over the threads. Sprites keep the scale they would have "
+                          "in the field of the whole document."
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "packsprites",
+                          "Like sprites, but pack the fields of the sprites into the output file "
+                          "and describe where each of them went in a JSON file next to it."
+                          ));
     cmdLine.addOption(QCommandLineOption(
                           "savesource",
                           "Save the source buffer used to generate the distance field as a PNG file "
                           "for debugging purposes.",
                           "filename"
                           ));
-    cmdLine.addPositionalArgument("inputfile", "SVG input file");
-    cmdLine.addPositionalArgument("outputfile", "PNG output file");
+    cmdLine.addOption(QCommandLineOption(
+                          "verify",
+                          "Also compute the field by searching the whole window around every pixel "
+                          "and report how many texels the chosen algorithm got differently, for "
+                          "checking faster searches and the seams between their bands."
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "progressive",
+                          "Write coarse previews into the output file before the final field. The "
+                          "first one is computed from the input rendered at 1/2^passes of the source "
+                          "size, and each following one from a source of twice the resolution, all "
+                          "before the full source gets rasterized, so a viewer "
+                          "reloading the file shows the shape right away and sharpens it as the "
+                          "bake proceeds. Not available with layers, sprites, tiles, sparse output, "
+                          "shards, gradients or the automatic target size.",
+                          "passes"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "tiles",
+                          "Write the distance field as a pyramid of size x size tiles into the "
+                          "directory given as the output file, laid out as zoom/x/y.png with an "
+                          "index.json describing the levels. Tiles of a single value, like those "
+                          "far inside or outside of the shapes, are only listed in the index. "
+                          "Not available with layers or sprites.",
+                          "size"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "sparse",
+                          "Split the distance field into size x size tiles and only store the "
+                          "tiles near an edge, packed into the output file. The tiles farther "
+                          "than the maximum distance from any edge aren't computed at all. A JSON "
+                          "file next to the output maps each tile to the slot it went into, or "
+                          "gives its value if it wasn't stored. Not available with layers, "
+                          "sprites, tiles, shards or gradients.",
+                          "size"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "coordinator",
+                          "Bake the jobs of the manifest on workers connecting to the given TCP "
+                          "port instead of baking a single file. The other options are passed on "
+                          "to the workers. Only the output file of each job is sent back, so "
+                          "options writing further files don't work with workers.",
+                          "port"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "manifest",
+                          "Text file listing the input and the output file of a job on each line "
+                          "for the coordinator, separated by a tab or by spaces.",
+                          "filename"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "localworkers",
+                          "Number of workers the coordinator starts on this machine.",
+                          "count",
+                          "0"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "shards",
+                          "Have the coordinator split the output of the input file into columns x "
+                          "rows shards baked by different workers and join them into the output "
+                          "file, instead of baking the jobs of a manifest. Each worker only "
+                          "rasterizes its part of the source plus the margin the distances reach "
+                          "into the neighbouring shards. With --submit, the service bakes the "
+                          "shards one at a time, so that more urgent requests can run in between, "
+                          "and joins them into the output file. Not available with the automatic "
+                          "target size, layers, sprites or progressive previews, and with sparse "
+                          "output only through --submit.",
+                          "columnsxrows"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "shard",
+                          "Only bake the shard in the given column and row of the output split "
+                          "into columns x rows parts. Used by the workers of a sharded bake.",
+                          "column,row,columns,rows"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "worker",
+                          "Bake jobs handed out by the coordinator at the given address until it "
+                          "runs out of them.",
+                          "host:port"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "service",
+                          "Keep running and bake the requests submitted to the given TCP port, "
+                          "one at a time in the order of their priority. A new request for the "
+                          "same output file cancels the earlier one. Requests may only use the "
+                          "options which don't write files of their own, besides --gradient and "
+                          "--savesource within the output root.",
+                          "port"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "listen-address",
+                          "Address the service accepts requests on, or the coordinator accepts "
+                          "workers on. Anything able to reach the service can have files written "
+                          "into the output root, and workers connecting to the coordinator "
+                          "deliver the outputs of the jobs handed to them. The default value is "
+                          "127.0.0.1.",
+                          "address",
+                          "127.0.0.1"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "output-root",
+                          "Directory the outputs of the requests to the service have to lie in. "
+                          "The default value is the current directory.",
+                          "directory",
+                          "."
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "submit",
+                          "Have the service at the given address bake the input file with the "
+                          "other options and wait for it to finish.",
+                          "host:port"
+                          ));
+    cmdLine.addOption(QCommandLineOption(
+                          "priority",
+                          "Priority of the request submitted to the service. Requests of a higher "
+                          "priority go first and suspend running bakes of a lower priority. "
+                          "The default value is 0.",
+                          "number",
+                          "0"
+                          ));
+    cmdLine.addPositionalArgument("inputfile", "SVG or bitmap input file, or an .sdf file to decode "
+                                  "into a PNG file");
+    cmdLine.addPositionalArgument("outputfile", "PNG output file, or an .sdf file to store the "
+                                  "distance field with a lossless codec made for distance fields");
     cmdLine.parse(a.arguments());
 
+    if (cmdLine.isSet("worker")) {
+        // The port follows the last colon, so that IPv6 addresses work as well
+        QString address = cmdLine.value("worker");
+        int colon = address.lastIndexOf(':');
+        bool portOk = false;
+        quint16 port = colon >= 0 ? address.mid(colon + 1).toUShort(&portOk) : 0;
+        if (!portOk || colon < 1) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        BatchWorker worker;
+        worker.connectToCoordinator(address.left(colon), port);
+        return a.exec();
+    }
+
+    if (cmdLine.isSet("service")) {
+        bool portOk = false;
+        quint16 port = cmdLine.value("service").toUShort(&portOk);
+        QHostAddress address(cmdLine.value("listen-address"));
+        QString outputRoot = cmdLine.value("output-root");
+        if (!portOk || address.isNull() || !QFileInfo(outputRoot).isDir()) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        BakeService service(outputRoot);
+        if (!service.listen(address, port))
+            return 1;
+        return a.exec();
+    }
+
+    if (cmdLine.isSet("submit")) {
+        QStringList address = cmdLine.value("submit").split(':');
+        bool portOk = false, priorityOk = false;
+        quint16 port = address.count() == 2 ? address.at(1).toUShort(&portOk) : 0;
+        int priority = cmdLine.value("priority").toInt(&priorityOk);
+        QStringList shards = cmdLine.isSet("shards") ? cmdLine.value("shards").split('x')
+                                                     : QStringList() << "1" << "1";
+        int columns = shards.value(0).toInt();
+        int rows = shards.value(1).toInt();
+        if (!portOk || address.at(0).isEmpty() || !priorityOk || shards.count() != 2
+                || columns < 1 || rows < 1 || cmdLine.positionalArguments().count() < 2) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        ServiceClient client;
+        client.submit(address.at(0), port, cmdLine.positionalArguments().at(0),
+                      cmdLine.positionalArguments().at(1),
+                      optionArguments(cmdLine, { "submit", "priority", "shards", "listen-address",
+                                                 "output-root" }),
+                      priority, columns, rows);
+        return a.exec();
+    }
+
+    if (cmdLine.isSet("coordinator")) {
+        bool portOk = false, workersOk = false;
+        quint16 port = cmdLine.value("coordinator").toUShort(&portOk);
+        int localWorkers = cmdLine.value("localworkers").toInt(&workersOk);
+        QStringList shards = cmdLine.value("shards").split('x');
+        int columns = shards.value(0).toInt();
+        int rows = shards.value(1).toInt();
+        bool sharded = cmdLine.isSet("shards");
+        int tileSize = cmdLine.isSet("tiles") ? cmdLine.value("tiles").toInt() : 0;
+        QHostAddress address(cmdLine.value("listen-address"));
+        // The workers would turn down the options which don't work with
+        // --shard only after every shard was dispatched to them
+        bool shardable = cmdLine.value("targetsize") != "auto" && !cmdLine.isSet("layers")
+                && !cmdLine.isSet("sprites") && !cmdLine.isSet("packsprites") && !cmdLine.isSet("sparse")
+                && !cmdLine.isSet("progressive");
+        if (!portOk || !workersOk || localWorkers < 0 || address.isNull()
+                || (cmdLine.isSet("tiles") && tileSize < 1)
+                || (sharded ? shards.count() != 2 || columns < 1 || rows < 1 || !shardable
+                              || cmdLine.positionalArguments().count() < 2
+                            : !cmdLine.isSet("manifest") || tileSize > 0)) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        // Pass the options given to the coordinator on to the workers
+        BatchCoordinator coordinator(optionArguments(cmdLine, { "coordinator", "manifest", "localworkers",
+                                                                "worker", "shards", "tiles",
+                                                                "listen-address" }));
+        if (!sharded) {
+            if (!coordinator.loadManifest(cmdLine.value("manifest")) || !coordinator.listen(address, port))
+                return 1;
+            coordinator.startLocalWorkers(localWorkers);
+            return a.exec();
+        }
+
+        QTemporaryDir shardDir;
+        for (int row = 0; row < rows; row++) {
+            for (int column = 0; column < columns; column++) {
+                coordinator.addJob(cmdLine.positionalArguments().at(0),
+                                   shardDir.filePath(QString("%1_%2.png").arg(column).arg(row)),
+                                   QStringList() << "--shard"
+                                   << QString("%1,%2,%3,%4").arg(column).arg(row).arg(columns).arg(rows));
+            }
+        }
+        if (!shardDir.isValid() || !coordinator.listen(address, port))
+            return 1;
+        coordinator.startLocalWorkers(localWorkers);
+        int result = a.exec();
+        if (result != 0)
+            return result;
+
+        QVector<QImage> shardFields;
+        for (int row = 0; row < rows; row++) {
+            for (int column = 0; column < columns; column++)
+                shardFields.append(QImage(shardDir.filePath(QString("%1_%2.png").arg(column).arg(row))));
+        }
+        QImage field = joinShards(shardFields, columns, rows);
+        if (field.isNull()) {
+            qWarning("The shards don't fit together.");
+            return 1;
+        }
+
+        QString outputFilename = cmdLine.positionalArguments().at(1);
+        writeField(field, outputFilename, tileSize, 0, qMax(1, int(thread::hardware_concurrency())));
+        qInfo("Saved %s", qPrintable(outputFilename));
+        return 0;
+    }
+
     if (cmdLine.positionalArguments().count() < 2) {
         puts(qPrintable(cmdLine.helpText()));
         return 0;
     }
 
-    QSvgRenderer svg(cmdLine.positionalArguments().at(0));
-    if (!svg.isValid())
+    QString inputFilename = cmdLine.positionalArguments().at(0);
+    if (inputFilename.endsWith(".sdf", Qt::CaseInsensitive)) {
+        QFile sdfFile(inputFilename);
+        if (!sdfFile.open(QIODevice::ReadOnly))
+            return 0;
+        QByteArray data = sdfFile.readAll();
+        vector<unsigned char> texels;
+        int width, height;
+        int numThreads = qMax(1, int(thread::hardware_concurrency()));
+        if (!decodeDistanceField(reinterpret_cast<const uchar *>(data.constData()), data.size(),
+                                 &texels, &width, &height, numThreads)) {
+            qWarning("%s isn't a valid distance field", qPrintable(inputFilename));
+            return 0;
+        }
+
+        QImage field(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; y++)
+            memcpy(field.scanLine(y), texels.data() + y * width, width);
+        QString outputFilename = cmdLine.positionalArguments().at(1);
+        field.save(outputFilename, "png");
+        qInfo("Saved %s", qPrintable(outputFilename));
         return 0;
+    }
+
+    QString parser = cmdLine.value("parser");
+    QSvgRenderer svg;
+    QFile svgFile(inputFilename);
+    SvgStreamReader streamReader(&svgFile);
+    QImage bitmap;
+    QSize svgSize;
+    bool isBitmap = !inputFilename.endsWith(".svg", Qt::CaseInsensitive)
+            && !inputFilename.endsWith(".svgz", Qt::CaseInsensitive);
+
+    if (isBitmap) {
+        // A shard only reads its part of the bitmap later on
+        QImageReader bitmapReader(inputFilename);
+        if (cmdLine.isSet("shard") && bitmapReader.size().isValid())
+            svgSize = bitmapReader.size();
+        else if (bitmap.load(inputFilename))
+            svgSize = bitmap.size();
+        else
+            return 0;
+    } else if (parser == "qsvg") {
+        // Hand the whole document to the renderer in one buffer
+        QFile documentFile(inputFilename);
+        if (!documentFile.open(QIODevice::ReadOnly) || !svg.load(documentFile.readAll()))
+            return 0;
+        svgSize = svg.defaultSize();
+    } else if (parser == "stream") {
+        if (!svgFile.open(QIODevice::ReadOnly) || !streamReader.readHeader())
+            return 0;
+        svgSize = streamReader.defaultSize();
+    } else {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
 
-    QSize svgSize = svg.defaultSize();
     float aspect = (float) svgSize.width() / svgSize.height();
 
     bool ok;
@@ -110,128 +628,766 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    int kernelDim = md * 2 + 1;
+    bool autoSourceSize = cmdLine.value("sourcesize") == "auto";
+    int longDim = autoSourceSize ? defaultSourceSize : cmdLine.value("sourcesize").toInt();
+    if (longDim < 1) {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
 
-    // Setup search kernel look-up table
-    int center = md;
-    shared_ptr<float> searchKernel(new float[kernelDim * kernelDim]);
+    int outputEdge = 0;
+    bool autoTargetSize = cmdLine.value("targetsize") == "auto";
+    float maxDisplayError = cmdLine.value("maxdisplayerror").toFloat(&ok);
+    if (!ok || maxDisplayError <= 0.0f) {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
+    if (cmdLine.isSet("targetsize") && !autoTargetSize) {
+        outputEdge = cmdLine.value("targetsize").toInt();
+        if (outputEdge < 1) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+    }
+
+    int numThreads;
 
-    int x = 0, y = 0;
-    for (int i = 0; i < kernelDim * kernelDim; i++) {
-        int dx = x - center; int dy = y - center;
-        searchKernel.get()[i] = sqrt(dx * dx + dy *dy);
-        x++;
-        if ((i + 1)% kernelDim == 0) {
-            y++;
-            x = 0;
+    if (cmdLine.isSet("threads")) {
+        numThreads = cmdLine.value("threads").toInt();
+        if (numThreads < 1) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+    } else {
+        numThreads = thread::hardware_concurrency();
+        if (numThreads == 0) {
+            qInfo("Couldn't figure out the number of hardware threads. Defaulting to 4.");
+            numThreads = 4;
         }
     }
 
-    float maxDist = sqrt(2 * center * center);
+    QString rasterizer = cmdLine.value("rasterizer");
+    if (rasterizer != "scanline" && rasterizer != "qpainter" && rasterizer != "adaptive") {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
 
-    int longDim = cmdLine.value("sourcesize").toInt();
-    if (longDim < 1) {
+    QString algorithm = cmdLine.value("algorithm");
+    if (algorithm != "bruteforce" && algorithm != "stroke" && algorithm != "contour"
+            && algorithm != "deadreckoning") {
         puts(qPrintable(cmdLine.helpText()));
         return 0;
     }
 
+    QString search = cmdLine.value("search");
+    if (search != "window" && search != "summedarea" && search != "coherent" && search != "runs") {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
+
+    QString quality = cmdLine.value("quality");
+    bool draft = quality == "draft";
+    if ((quality != "exact" && !draft)
+            || (draft && (algorithm != "bruteforce" || cmdLine.isSet("gradient") || autoTargetSize))) {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
+
+    if (autoSourceSize && !isBitmap) {
+        float maxError = cmdLine.value("maxerror").toFloat(&ok);
+        if (!ok || maxError <= 0.0f) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        // Measure the details of the document laid out with a known long edge
+        const qreal referenceEdge = 1000.0;
+        QRectF referenceRect(0.0, 0.0, aspect < 1.0 ? referenceEdge * aspect : referenceEdge,
+                             aspect < 1.0 ? referenceEdge : referenceEdge / aspect);
+        qreal featureSize = referenceEdge;
+        if (parser == "stream") {
+            // The reader of the actual pass can't be rewound, so use one of its own
+            QFile analysisFile(inputFilename);
+            SvgStreamReader analysisReader(&analysisFile);
+            if (analysisFile.open(QIODevice::ReadOnly) && analysisReader.readHeader()) {
+                analysisReader.setTargetRect(referenceRect);
+                QVector<Shape> batch;
+                while (analysisReader.readShapes(&batch, streamBatchSize)) {
+                    featureSize = qMin(featureSize, minimumFeatureSize(batch));
+                    batch.clear();
+                }
+            }
+        } else {
+            ShapeRecorder recorder(referenceRect.size().toSize());
+            QPainter recordingPainter(&recorder);
+            svg.render(&recordingPainter, referenceRect);
+            recordingPainter.end();
+            featureSize = qMin(featureSize, minimumFeatureSize(recorder.shapes()));
+        }
+
+        // A source pixel may span at most maxError output texels
+        qreal featureEdge = minimumFeaturePixels * referenceEdge / featureSize;
+        qreal errorEdge = outputEdge / maxError;
+        longDim = qBound<qreal>(minimumSourceSize, ceil(qMax(featureEdge, errorEdge)), maximumSourceSize);
+        md = qMax(1, qRound(md * qreal(longDim) / defaultSourceSize));
+        qInfo("Smallest feature is %.3g%% of the image. Using a source size of %d and a maxdist of %d.",
+              100.0 * featureSize / referenceEdge, longDim, md);
+    }
+
+    if (draft && !cmdLine.isSet("sourcesize")) {
+        // A few source pixels per output texel are plenty for a draft
+        int sourceEdge = isBitmap ? qMax(svgSize.width(), svgSize.height()) : longDim;
+        int targetEdge = outputEdge > 0 ? outputEdge : sourceEdge / 16;
+        longDim = qBound(qMin(minimumSourceSize, sourceEdge), draftSourceScale * targetEdge, sourceEdge);
+        md = qMax(1, qRound(md * qreal(longDim) / sourceEdge));
+        outputEdge = qMax(1, targetEdge);
+    }
+
+    int kernelDim = md * 2 + 1;
+    int center = md;
+
+    float maxDist = maxDistance(md);
+
     QSize imageSize = aspect < 1.0 ? QSize(longDim * aspect, longDim) : QSize(longDim, longDim / aspect);
-    qInfo("Rendering SVG to %dx%d", imageSize.width(), imageSize.height());
-    QImage i(imageSize + QSize(kernelDim, kernelDim), QImage::Format_Grayscale8);
+    if (isBitmap && (autoSourceSize || (!cmdLine.isSet("sourcesize") && !draft)))
+        imageSize = svgSize;
+    QSize outputSize(imageSize / 16.0f);
+    if (outputEdge > 0) {
+        outputSize = aspect < 1.0 ? QSize(outputEdge * aspect, outputEdge) :
+                                    QSize(outputEdge, outputEdge / aspect);
+    }
+
+    int gradientBits = cmdLine.value("gradientbits").toInt();
+    if (gradientBits != 8 && gradientBits != 16) {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
+
+    int tileSize = 0;
+    if (cmdLine.isSet("tiles")) {
+        tileSize = cmdLine.value("tiles").toInt();
+        if (tileSize < 1 || cmdLine.isSet("layers") || cmdLine.isSet("sprites")
+                || cmdLine.isSet("packsprites")) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+    }
+
+    int sparseTileSize = 0;
+    if (cmdLine.isSet("sparse")) {
+        sparseTileSize = cmdLine.value("sparse").toInt();
+        if (sparseTileSize < 1 || cmdLine.isSet("layers") || cmdLine.isSet("sprites")
+                || cmdLine.isSet("packsprites") || cmdLine.isSet("tiles") || cmdLine.isSet("shard")
+                || cmdLine.isSet("gradient")) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+    }
+
+    int progressivePasses = 0;
+    if (cmdLine.isSet("progressive")) {
+        progressivePasses = cmdLine.value("progressive").toInt();
+        if (progressivePasses < 1 || cmdLine.isSet("layers") || cmdLine.isSet("sprites")
+                || cmdLine.isSet("packsprites") || cmdLine.isSet("tiles") || cmdLine.isSet("sparse")
+                || cmdLine.isSet("shard") || cmdLine.isSet("gradient") || autoTargetSize) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+    }
+
+    if (rasterizer == "adaptive"
+            && (algorithm != "bruteforce" || draft || autoTargetSize || cmdLine.isSet("layers")
+                || cmdLine.isSet("sprites") || cmdLine.isSet("packsprites") || cmdLine.isSet("sparse")
+                || cmdLine.isSet("progressive") || cmdLine.isSet("savesource"))) {
+        puts(qPrintable(cmdLine.helpText()));
+        return 0;
+    }
 
     bool negate = cmdLine.isSet("negate");
-    i.fill(negate ? Qt::black : Qt::white);
-    QPainter painter(&i);
-    svg.render(&painter, QRectF(center, center, imageSize.width(), imageSize.height()));
+    bool verify = cmdLine.isSet("verify");
+    bool saveGradient = cmdLine.isSet("gradient");
 
-    if (cmdLine.isSet("savesource"))
-        i.save(cmdLine.value("savesource"), "png");
+    // Part of the output this process bakes, which is all of it unless sharded
+    bool sharded = cmdLine.isSet("shard");
+    QRect shard(QPoint(0, 0), outputSize);
+    if (sharded) {
+        QStringList fields = cmdLine.value("shard").split(',');
+        int column = fields.value(0).toInt();
+        int row = fields.value(1).toInt();
+        int columns = fields.value(2).toInt();
+        int rows = fields.value(3).toInt();
+        if (fields.count() != 4 || column < 0 || column >= columns || row < 0 || row >= rows
+                || columns > outputSize.width() || rows > outputSize.height() || autoTargetSize
+                || cmdLine.isSet("layers") || cmdLine.isSet("sprites") || cmdLine.isSet("packsprites")) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+        shard = shardRect(outputSize, column, row, columns, rows);
+    }
 
-    QImage df(imageSize, QImage::Format_Grayscale8);
+    // The shard in image coordinates and the pixels of the source covering it.
+    // The source buffer extends padding pixels beyond them, which has to reach
+    // as far as the distances are measured: the search radius for bruteforce
+    // and deadreckoning and the maximum distance for the other algorithms.
+    qreal shardScaleX = qreal(imageSize.width()) / outputSize.width();
+    qreal shardScaleY = qreal(imageSize.height()) / outputSize.height();
+    QRectF shardArea(shard.x() * shardScaleX, shard.y() * shardScaleY,
+                     shard.width() * shardScaleX, shard.height() * shardScaleY);
+    QRect sourceCrop = shardArea.toAlignedRect() & QRect(QPoint(0, 0), imageSize);
+    int padding = !sharded || algorithm == "bruteforce" || algorithm == "deadreckoning"
+            ? md : qMax(md, int(ceil(maxDist)) + 1);
 
+    QSize sourceSize = sourceCrop.size() + QSize(padding * 2 + 1, padding * 2 + 1);
+    QRectF renderBounds(padding - sourceCrop.x(), padding - sourceCrop.y(),
+                        imageSize.width(), imageSize.height());
+    QRectF fieldArea = shardArea.translated(renderBounds.topLeft());
+    QImage df;
+    QImage gradient;
+    SparseField sparse;
     QElapsedTimer elapsed;
-    elapsed.start();
 
-    int imageScanlineLength = i.scanLine(1) - i.scanLine(0);
+    // Computes the distance field of area of a source buffer at fieldSize,
+    // measuring distances up to the given search radius
+    auto radiusField = [&](const QImage &source, const QRectF &area, const QSize &fieldSize, int radius,
+                           bool negateSource, int threads, QImage *sourceGradient) {
+        QImage field;
+        if (algorithm == "contour") {
+            ContourDistanceField contour(source, maxDistance(radius), negateSource);
+            field = QImage(fieldSize, QImage::Format_Grayscale8);
+            if (sourceGradient)
+                *sourceGradient = QImage(fieldSize, QImage::Format_RGBA64);
+            contour.render(area, &field, threads, sourceGradient);
+        } else {
+            // The search wants exactly its radius of padding around the pixels
+            QRect pixels = area.toAlignedRect();
+            QImage padded = pixels.topLeft() == QPoint(radius, radius)
+                    ? source : source.copy(pixels.adjusted(-radius, -radius, radius, radius));
+            field = QImage(pixels.size(), QImage::Format_Grayscale8);
+            if (sourceGradient)
+                *sourceGradient = QImage(pixels.size(), QImage::Format_RGBA64);
+            if (draft)
+                chamferDistanceField(padded, radius, &field, threads);
+            else if (algorithm == "deadreckoning")
+                deadReckoningDistanceField(padded, radius, &field, threads, sourceGradient);
+            else if (search == "summedarea")
+                summedAreaDistanceField(padded, radius, &field, threads, sourceGradient);
+            else if (search == "coherent")
+                coherentDistanceField(padded, radius, &field, threads, sourceGradient);
+            else if (search == "runs")
+                runLengthDistanceField(RunLengthMask(padded, threads), radius, &field, threads, sourceGradient);
+            else
+                bruteForceDistanceField(padded, radius, &field, threads, sourceGradient);
 
-    const float* kernelPtr = searchKernel.get();
+            if (verify && (draft || algorithm == "deadreckoning" || search != "window")) {
+                QImage reference(pixels.size(), QImage::Format_Grayscale8);
+                bruteForceDistanceField(padded, radius, &reference, threads);
+                int differing, largest;
+                compareFields(field, reference, &differing, &largest);
+                qInfo("%d texels differ from the window search by up to %d levels", differing, largest);
+            }
 
-    auto calculateDistance = [&](int interleave, int lineStride) {
-        for (int y = interleave; y < imageSize.height(); y += lineStride) {
-            const uchar* imageLine = i.constScanLine(y);
-            uchar* fieldLine = df.scanLine(y);
+            if (negateSource)
+                field.invertPixels();
 
-            for (int x = 0; x < imageSize.width(); x++) {
-                int kernelIndex = 0;
-                bool inside = imageLine[x + center + center * imageScanlineLength] >= 128;
-                float minDistance = 1e6;
+            field = field.scaled(fieldSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            if (sourceGradient)
+                *sourceGradient = scaleGradient(*sourceGradient, fieldSize, negateSource);
+        }
+        return field;
+    };
 
-                for (int j = 0; j < kernelDim; j++) {
-                    for (int i = 0; i < kernelDim; i++) {
-                        unsigned char px = imageLine[x + i + j * imageScanlineLength];
-                        if ((inside && px < 128) || (!inside && px >= 128))
-                            minDistance = min(kernelPtr[kernelIndex++], minDistance);
-                    }
-                }
+    auto sourceField = [&](const QImage &source, const QRectF &area, const QSize &fieldSize,
+                           bool negateSource, int threads, QImage *sourceGradient) {
+        return radiusField(source, area, fieldSize, md, negateSource, threads, sourceGradient);
+    };
 
-                if (minDistance > maxDist)
-                    minDistance = maxDist;
+    if (cmdLine.isSet("layers")) {
+        QString layerKey = cmdLine.value("layers");
+        if ((layerKey != "color" && layerKey != "element") || isBitmap
+                || (layerKey == "element" && parser != "stream")) {
+            puts(qPrintable(cmdLine.helpText()));
+            return 0;
+        }
+
+        LayerMasks layers(layerKey == "color" ? LayerMasks::ByColor : LayerMasks::ByElement,
+                          sourceSize, rasterizer == "qpainter", numThreads);
+        if (parser == "stream") {
+            streamReader.setTargetRect(renderBounds);
+            QVector<Shape> batch;
+            while (streamReader.readShapes(&batch, streamBatchSize)) {
+                layers.add(batch);
+                batch.clear();
+            }
 
-                if (inside)
-                    minDistance = -minDistance;
+            if (streamReader.hasError())
+                qWarning("Error while parsing the SVG: %s", qPrintable(streamReader.errorString()));
+        } else {
+            ShapeRecorder recorder(sourceSize);
+            QPainter recordingPainter(&recorder);
+            svg.render(&recordingPainter, renderBounds);
+            recordingPainter.end();
 
-                *fieldLine++ = ((minDistance / maxDist) + 1.0) * 0.5  * 255;
+            if (!recorder.isComplete()) {
+                qWarning("The SVG uses features (images, gradients, clipping) which can't be split into layers.");
+                return 0;
             }
+            layers.add(recorder.shapes());
         }
-    };
 
-    int numThreads;
+        if (layers.count() == 0) {
+            qWarning("The SVG doesn't contain anything to split into layers.");
+            return 0;
+        }
 
-    if (cmdLine.isSet("threads")) {
-        numThreads = cmdLine.value("threads").toInt();
-        if (numThreads < 1) {
+        // Fields of different layers are computed concurrently, sharing the threads
+        int concurrentLayers = qMin(numThreads, layers.count());
+        int threadsPerLayer = qMax(1, numThreads / concurrentLayers);
+        QVector<QImage> fields(layers.count());
+        qInfo("Using %d threads for %d layers", numThreads, layers.count());
+        elapsed.start();
+        runThreads(concurrentLayers, [&](int threadId) {
+            for (int layer = threadId; layer < layers.count(); layer += concurrentLayers)
+                fields[layer] = sourceField(layers.mask(layer), renderBounds, outputSize, false,
+                                            threadsPerLayer, nullptr);
+        });
+        qInfo("Generated %d distance fields of size %dx%d in %dms", layers.count(),
+              outputSize.width(), outputSize.height(), (int) elapsed.elapsed());
+
+        QString outputFilename = cmdLine.positionalArguments().at(1);
+        if (cmdLine.isSet("layerfiles") || layers.count() > 4) {
+            QFileInfo output(outputFilename);
+            for (int layer = 0; layer < layers.count(); layer++) {
+                QString layerFilename = output.path() + "/" + output.completeBaseName() + "_"
+                        + layers.name(layer) + ".png";
+                fields.at(layer).save(layerFilename, "png");
+                qInfo("Saved layer %s to %s", qPrintable(layers.name(layer)), qPrintable(layerFilename));
+            }
+        } else {
+            // Unused color channels stay zero and an unused alpha channel opaque
+            QImage channels(outputSize, QImage::Format_RGBA8888);
+            channels.fill(qRgba(0, 0, 0, 255));
+            const char *channelNames[] = { "red", "green", "blue", "alpha" };
+            for (int layer = 0; layer < layers.count(); layer++) {
+                for (int y = 0; y < outputSize.height(); y++) {
+                    const uchar *fieldLine = fields.at(layer).constScanLine(y);
+                    uchar *line = channels.scanLine(y) + layer;
+                    for (int x = 0; x < outputSize.width(); x++)
+                        line[x * 4] = fieldLine[x];
+                }
+                qInfo("Layer %s is in the %s channel", qPrintable(layers.name(layer)), channelNames[layer]);
+            }
+            channels.save(outputFilename, "png");
+            qInfo("Saved %s", qPrintable(outputFilename));
+        }
+        return 0;
+    }
+
+    if (cmdLine.isSet("sprites") || cmdLine.isSet("packsprites")) {
+        if (parser != "stream" || isBitmap) {
             puts(qPrintable(cmdLine.helpText()));
             return 0;
         }
-    } else {
-        numThreads = thread::hardware_concurrency();
-        if (numThreads == 0) {
-            qInfo("Couldn't figure out the number of hardware threads. Defaulting to 4.");
-            numThreads = 4;
+
+        QVector<Shape> documentShapes;
+        loadShapes(&streamReader, &svg, true, renderBounds, sourceSize, &documentShapes);
+
+        // Leave room around each sprite for the distances to fall off
+        QVector<Sprite> sprites = splitSprites(documentShapes, ceil(maxDist));
+        documentShapes.clear();
+        if (sprites.isEmpty()) {
+            qWarning("The SVG doesn't have any top level elements with an id.");
+            return 0;
+        }
+
+        // Each sprite is baked on a single thread, taking the next one when done
+        qreal fieldScale = qreal(outputSize.width()) / imageSize.width();
+        atomic<int> nextSprite(0);
+        qInfo("Using %d threads for %d sprites", numThreads, sprites.count());
+        elapsed.start();
+        runThreads(numThreads, [&](int) {
+            for (int index = nextSprite++; index < sprites.count(); index = nextSprite++) {
+                Sprite &sprite = sprites[index];
+                QPointF offset(center - sprite.area.left(), center - sprite.area.top());
+                for (Shape &shape : sprite.shapes) {
+                    for (QPolygonF &polygon : shape.polygons)
+                        polygon.translate(offset);
+                    shape.bounds.translate(offset);
+                }
+
+                QImage source(sprite.area.size() + QSize(kernelDim, kernelDim), QImage::Format_Grayscale8);
+                source.fill(negate ? Qt::black : Qt::white);
+                if (rasterizer == "qpainter")
+                    paintShapes(sprite.shapes, &source, 1);
+                else
+                    rasterizeShapes(sprite.shapes, &source, 1);
+                sprite.shapes.clear();
+
+                QSize fieldSize(qMax(1, qRound(sprite.area.width() * fieldScale)),
+                                qMax(1, qRound(sprite.area.height() * fieldScale)));
+                sprite.field = sourceField(source, QRectF(QPointF(center, center), sprite.area.size()),
+                                           fieldSize, negate, 1, nullptr);
+            }
+        });
+        qInfo("Generated %d distance fields in %dms", sprites.count(), (int) elapsed.elapsed());
+
+        QString outputFilename = cmdLine.positionalArguments().at(1);
+        QFileInfo output(outputFilename);
+        if (cmdLine.isSet("packsprites")) {
+            QSize sheetSize = packSprites(&sprites, 2);
+            QImage sheet(sheetSize, QImage::Format_Grayscale8);
+            sheet.fill(Qt::black);
+            QJsonArray manifest;
+            for (const Sprite &sprite : sprites) {
+                for (int y = 0; y < sprite.field.height(); y++) {
+                    memcpy(sheet.scanLine(sprite.position.y() + y) + sprite.position.x(),
+                           sprite.field.constScanLine(y), sprite.field.width());
+                }
+                QJsonObject entry;
+                entry.insert("id", sprite.id);
+                entry.insert("x", sprite.position.x());
+                entry.insert("y", sprite.position.y());
+                entry.insert("width", sprite.field.width());
+                entry.insert("height", sprite.field.height());
+                manifest.append(entry);
+            }
+            sheet.save(outputFilename, "png");
+            qInfo("Saved %s", qPrintable(outputFilename));
+
+            QFile manifestFile(output.path() + "/" + output.completeBaseName() + ".json");
+            if (manifestFile.open(QIODevice::WriteOnly)) {
+                manifestFile.write(QJsonDocument(manifest).toJson());
+                qInfo("Saved %s", qPrintable(manifestFile.fileName()));
+            }
+        } else {
+            for (const Sprite &sprite : sprites) {
+                QString spriteFilename = output.path() + "/" + output.completeBaseName() + "_"
+                        + sprite.id + ".png";
+                sprite.field.save(spriteFilename, "png");
+                qInfo("Saved %s", qPrintable(spriteFilename));
+            }
         }
+        return 0;
     }
 
-    qInfo("Using %d threads", numThreads);
-    vector<thread> threads;
-    threads.reserve(numThreads);
-    for (int threadId = 0; threadId < numThreads; threadId++) {
-        threads.push_back(thread([=]() {
-            calculateDistance(threadId, numThreads);
-        }));
+    // Shapes of the whole input once they've been collected for the stroke algorithm,
+    // the adaptive rasterizer or the progressive previews
+    QVector<Shape> shapes;
+    bool haveShapes = false;
+    // Set once the field has gone into the output as it was computed
+    bool fieldWritten = false;
+    QString outputFilename = cmdLine.positionalArguments().at(1);
+
+    if (algorithm == "stroke" && autoTargetSize) {
+        qInfo("The automatic target size needs a source buffer. Falling back to bruteforce.");
+    } else if (algorithm == "stroke" && !isBitmap) {
+        haveShapes = loadShapes(&streamReader, &svg, parser == "stream", renderBounds, sourceSize, &shapes);
+        if (haveShapes && StrokeDistanceField::canRender(shapes, negate)) {
+            qInfo("Using %d threads", numThreads);
+            elapsed.start();
+            StrokeDistanceField field(QRect(QPoint(0, 0), sourceSize), maxDist);
+            for (const Shape &shape : shapes)
+                field.addStroke(shape.stroke);
+            df = QImage(shard.size(), QImage::Format_Grayscale8);
+            if (saveGradient)
+                gradient = QImage(shard.size(), QImage::Format_RGBA64);
+            field.render(fieldArea, &df, numThreads, saveGradient ? &gradient : nullptr);
+        } else {
+            qInfo("The SVG doesn't consist of solid strokes only. Falling back to bruteforce.");
+        }
+    } else if (algorithm == "stroke") {
+        qInfo("Bitmaps don't have strokes. Falling back to bruteforce.");
     }
 
-    for (int threadId = 0; threadId < numThreads; threadId++)
-        threads[threadId].join();
+    if (df.isNull() && rasterizer == "adaptive") {
+        if (isBitmap) {
+            qInfo("Bitmaps can't be rasterized adaptively. Falling back to scanline.");
+        } else {
+            // The stroke algorithm may have collected them already
+            if (shapes.isEmpty())
+                haveShapes = loadShapes(&streamReader, &svg, parser == "stream", renderBounds, sourceSize,
+                                        &shapes);
+            if (!haveShapes)
+                qInfo("The SVG uses features which can't be rendered in tiles. Falling back to scanline.");
+        }
 
-    if (negate)
-        df.invertPixels();
+        // Nothing of the source size gets allocated: the mask keeps its edges
+        // as runs, which the runs search consumes as they are, and the field
+        // is computed a band at a time and scaled into the output right away.
+        // The field of a shard starts wherever its pixels lie in the mask.
+        QRect pixels = fieldArea.toAlignedRect();
+        if (haveShapes && !QRect(QPoint(0, 0), sourceSize).contains(pixels.adjusted(-md, -md, md, md))) {
+            qInfo("The shard doesn't leave room for the search radius in the source. Falling back to scanline.");
+        } else if (haveShapes) {
+            qInfo("Rasterizing SVG adaptively to %dx%d", imageSize.width(), imageSize.height());
+            RunLengthMask mask = rasterizeAdaptive(shapes, sourceSize, negate ? 0 : 255,
+                                                   adaptiveTileSize, numThreads);
+            shapes.clear();
 
-    QString outputFilename = cmdLine.positionalArguments().at(1);
-    QSize outputSize(imageSize / 16.0f);
-    if (cmdLine.isSet("targetsize")) {
-        int outputEdge = cmdLine.value("targetsize").toInt();
-        if (outputEdge < 1) {
-            puts(qPrintable(cmdLine.helpText()));
-            return 0;
+            elapsed.start();
+            qInfo("Using %d threads", numThreads);
+            if (saveGradient)
+                gradient = QImage(shard.size(), QImage::Format_RGBA64);
+
+            // Computes the field a band at a time, handing the output rows to
+            // the pyramid if there is one and copying them into df otherwise.
+            // A thread searches the bands ahead while the ones before are
+            // scaled and written, with two of them queued at most.
+            struct FieldBand
+            {
+                int firstLine;
+                QImage field;
+                QImage gradient;
+            };
+            auto bakeBands = [&](TilePyramidWriter *pyramid) {
+                BoundedQueue<FieldBand> bands(2);
+                thread searcher([&]() {
+                    // Enough rows for every thread to search a few bands of its own
+                    int bandHeight = qMax(64, md * 4) * numThreads * 2;
+                    for (int firstLine = 0; firstLine < pixels.height(); firstLine += bandHeight) {
+                        FieldBand band;
+                        band.firstLine = firstLine;
+                        band.field = QImage(pixels.width(), qMin(bandHeight, pixels.height() - firstLine),
+                                            QImage::Format_Grayscale8);
+                        if (saveGradient)
+                            band.gradient = QImage(band.field.size(), QImage::Format_RGBA64);
+                        runLengthDistanceField(mask, md, &band.field, numThreads,
+                                               saveGradient ? &band.gradient : nullptr,
+                                               pixels.topLeft() + QPoint(-md, firstLine - md));
+                        bands.push(std::move(band));
+                    }
+                    bands.close();
+                });
+
+                FieldDownscaler downscaler(pixels.size(), shard.size(), negate, saveGradient);
+                FieldBand band;
+                int row = 0;
+                while (bands.pop(&band)) {
+                    downscaler.addBand(band.firstLine, band.field, saveGradient ? &band.gradient : nullptr,
+                                       numThreads);
+                    QImage rows, gradientRows;
+                    int count = downscaler.takeRows(&rows, saveGradient ? &gradientRows : nullptr);
+                    for (int y = 0; y < count; y++) {
+                        if (!pyramid)
+                            memcpy(df.scanLine(row + y), rows.constScanLine(y), rows.width());
+                        if (saveGradient)
+                            memcpy(gradient.scanLine(row + y), gradientRows.constScanLine(y),
+                                   gradientRows.width() * 8);
+                    }
+                    if (pyramid && count > 0)
+                        pyramid->addRows(rows);
+                    row += count;
+                }
+                searcher.join();
+            };
+
+            // A tile pyramid gets written as the rows come out, so the field
+            // doesn't exist as a whole at the output size either
+            if (tileSize > 0) {
+                TilePyramidWriter pyramid(shard.size(), outputFilename, tileSize, numThreads);
+                bakeBands(&pyramid);
+                if (!pyramid.finish())
+                    qWarning("Failed to write all tiles into %s", qPrintable(outputFilename));
+                fieldWritten = true;
+            } else {
+                df = QImage(shard.size(), QImage::Format_Grayscale8);
+                bakeBands(nullptr);
+            }
+        }
+    }
+
+    if (df.isNull() && !fieldWritten && progressivePasses > 0) {
+        // The previews render the input at their own resolution, so that the
+        // first one is out before the full source has been rasterized. The
+        // shapes are collected once for all passes.
+        if (!isBitmap && shapes.isEmpty())
+            haveShapes = loadShapes(&streamReader, &svg, parser == "stream", renderBounds, sourceSize, &shapes);
+
+        elapsed.start();
+        for (int pass = progressivePasses; pass > 0; pass--) {
+            // Shrink the source with the search radius, keeping a margin of
+            // background around it for the search to reach into
+            qreal factor = 1 << pass;
+            int radius = qMax(1, qRound(md / factor));
+            QSize scaledSize(qMax(1, qRound(sourceSize.width() / factor)),
+                             qMax(1, qRound(sourceSize.height() / factor)));
+            QImage coarse(scaledSize + QSize(radius * 2, radius * 2), QImage::Format_Grayscale8);
+            coarse.fill(negate ? Qt::black : Qt::white);
+
+            QTransform toCoarse(qreal(scaledSize.width()) / sourceSize.width(), 0.0, 0.0,
+                                qreal(scaledSize.height()) / sourceSize.height(), radius, radius);
+            if (haveShapes) {
+                QVector<Shape> coarseShapes = mapShapes(shapes, toCoarse);
+                if (rasterizer == "qpainter")
+                    paintShapes(coarseShapes, &coarse, numThreads);
+                else
+                    rasterizeShapes(coarseShapes, &coarse, numThreads);
+            } else {
+                QPainter painter(&coarse);
+                painter.setRenderHint(QPainter::SmoothPixmapTransform);
+                if (isBitmap)
+                    painter.drawImage(toCoarse.mapRect(renderBounds), bitmap);
+                else
+                    svg.render(&painter, toCoarse.mapRect(renderBounds));
+            }
+
+            QImage preview = radiusField(coarse, toCoarse.mapRect(fieldArea), shard.size(), radius, negate,
+                                         numThreads, nullptr);
+            if (saveField(preview, cmdLine.positionalArguments().at(1), numThreads))
+                qInfo("Saved a preview from a %dx%d source after %dms", scaledSize.width(),
+                      scaledSize.height(), int(elapsed.elapsed()));
+        }
+    }
+
+    if (df.isNull() && !fieldWritten) {
+        qInfo("Rendering %s to %dx%d", isBitmap ? "bitmap" : "SVG",
+              imageSize.width(), imageSize.height());
+        QImage i(sourceSize, QImage::Format_Grayscale8);
+        i.fill(negate ? Qt::black : Qt::white);
+
+        bool rendered = false;
+        if (!bitmap.isNull()) {
+            QPainter painter(&i);
+            painter.setRenderHint(QPainter::SmoothPixmapTransform);
+            painter.drawImage(renderBounds, bitmap);
+            rendered = true;
+        } else if (isBitmap) {
+            // Only the part of the bitmap the shard sees gets decoded
+            QRect clip = QRect(QPoint(0, 0), imageSize)
+                    & QRect(sourceCrop.topLeft() - QPoint(padding, padding), sourceSize);
+            QImageReader bitmapReader(inputFilename);
+            bitmapReader.setScaledSize(imageSize);
+            bitmapReader.setScaledClipRect(clip);
+            QPainter painter(&i);
+            painter.drawImage(renderBounds.topLeft() + clip.topLeft(), bitmapReader.read());
+            rendered = true;
+        } else if (haveShapes) {
+            if (rasterizer == "qpainter")
+                paintShapes(shapes, &i, numThreads);
+            else
+                rasterizeShapes(shapes, &i, numThreads);
+            rendered = true;
+        } else if (parser == "stream") {
+            // Rasterize in batches so that only a bounded number of shapes is alive at a time
+            streamReader.setTargetRect(renderBounds);
+            QVector<Shape> batch;
+            while (streamReader.readShapes(&batch, streamBatchSize)) {
+                if (rasterizer == "qpainter")
+                    paintShapes(batch, &i, numThreads);
+                else
+                    rasterizeShapes(batch, &i, numThreads);
+                batch.clear();
+            }
+
+            if (streamReader.hasError())
+                qWarning("Error while parsing the SVG: %s", qPrintable(streamReader.errorString()));
+            rendered = true;
+        } else {
+            QVector<Shape> recorded;
+            if (loadShapes(&streamReader, &svg, false, renderBounds, i.size(), &recorded)) {
+                if (rasterizer == "qpainter")
+                    paintShapes(recorded, &i, numThreads);
+                else
+                    rasterizeShapes(recorded, &i, numThreads);
+                rendered = true;
+            } else {
+                qInfo("The SVG uses features which can't be rendered in tiles. Using QSvgRenderer directly.");
+            }
+        }
+
+        if (!rendered) {
+            QPainter painter(&i);
+            svg.render(&painter, renderBounds);
+        }
+
+        if (cmdLine.isSet("savesource"))
+            i.save(cmdLine.value("savesource"), "png");
+
+        elapsed.start();
+        qInfo("Using %d threads", numThreads);
+
+        // The brute force field gets computed at the source size anyway, so the
+        // candidates of the automatic target size are just downscaled from it
+        QImage fullField;
+        if (autoTargetSize) {
+            if (algorithm != "contour")
+                fullField = sourceField(i, renderBounds, imageSize, negate, numThreads, nullptr);
+
+            vector<ReconstructionCheck> checks;
+            for (int displayScale = 1; displayScale <= 4; displayScale *= 2) {
+                checks.push_back(ReconstructionCheck(i, renderBounds.toRect(), negate,
+                                                     imageSize / displayScale));
+            }
+
+            int longEdge = qMax(imageSize.width(), imageSize.height());
+            for (int edge = 16; ; edge = ceil(edge * 1.25)) {
+                edge = qMin(edge, longEdge);
+                QSize candidate = aspect < 1.0 ? QSize(qMax(1, int(edge * aspect)), edge) :
+                                                 QSize(edge, qMax(1, int(edge / aspect)));
+                QImage field = fullField.isNull()
+                        ? sourceField(i, renderBounds, candidate, negate, numThreads, nullptr)
+                        : fullField.scaled(candidate, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+                qreal error = 0.0;
+                for (const ReconstructionCheck &check : checks)
+                    error = qMax(error, check.error(field, numThreads));
+                qInfo("Target size %d reconstructs edges within %.3f display pixels", edge, error);
+
+                if (error <= maxDisplayError || edge == longEdge) {
+                    outputSize = candidate;
+                    shard = QRect(QPoint(0, 0), outputSize);
+                    break;
+                }
+            }
+        }
+
+        if (sparseTileSize > 0) {
+            // Tiles without the other side of the threshold within reach are
+            // saturated, so only the others need a field
+            sparse = SparseField(shard.size(), sparseTileSize);
+            qreal scaleX = fieldArea.width() / shard.width();
+            qreal scaleY = fieldArea.height() / shard.height();
+            int reach = ceil(maxDist) + 1;
+            atomic<int> nextTile(0);
+            runThreads(numThreads, [&](int) {
+                for (int tile = nextTile++; tile < sparse.tileCount(); tile = nextTile++) {
+                    QRect rect = sparse.tileRect(tile);
+                    QRectF area(fieldArea.x() + rect.x() * scaleX, fieldArea.y() + rect.y() * scaleY,
+                                rect.width() * scaleX, rect.height() * scaleY);
+                    QRect pixels = area.toAlignedRect().adjusted(-reach, -reach, reach, reach) & i.rect();
+                    int value = uniformFieldValue(i, pixels, negate);
+                    if (value >= 0) {
+                        sparse.setUniform(tile, value);
+                    } else {
+                        sparse.setTile(tile, sourceField(i.copy(pixels), area.translated(-pixels.topLeft()),
+                                                         rect.size(), negate, 1, nullptr));
+                    }
+                }
+            });
+            qInfo("Computed %d of %d tiles", sparse.storedTileCount(), sparse.tileCount());
+        } else if (!fullField.isNull() && !saveGradient) {
+            df = fullField.scaled(outputSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        } else {
+            df = sourceField(i, fieldArea, shard.size(), negate, numThreads,
+                             saveGradient ? &gradient : nullptr);
         }
-        outputSize = aspect < 1.0 ? QSize(outputEdge * aspect, outputEdge) :
-                                    QSize(outputEdge, outputEdge / aspect);
     }
+
     qInfo("Generated distance field of size %dx%d in %dms",
-          outputSize.width(), outputSize.height(), (int) elapsed.elapsed());
+          shard.width(), shard.height(), (int) elapsed.elapsed());
 
-    df = df.scaled(outputSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-    df.save(outputFilename, "png");
+    if (!sparse.isNull()) {
+        if (!sparse.save(outputFilename))
+            qWarning("Failed to save %s", qPrintable(outputFilename));
+    } else if (!fieldWritten) {
+        writeField(df, outputFilename, tileSize, sparseTileSize, numThreads);
+    }
     qInfo("Saved %s", qPrintable(outputFilename));
-}
 
+    if (saveGradient) {
+        QString gradientFilename = cmdLine.value("gradient");
+        if (gradientBits == 8)
+            gradient = gradient.convertToFormat(QImage::Format_RGB888);
+        gradient.save(gradientFilename, "png");
+        qInfo("Saved %s", qPrintable(gradientFilename));
+    }
+}
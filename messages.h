@@ -0,0 +1,62 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QTcpSocket>
+
+// Messages are QByteArrays on a QDataStream, starting with a message type
+// defined by the protocol using them.
+
+inline void sendMessage(QTcpSocket *socket, const QByteArray &message)
+{
+    QDataStream stream(socket);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << message;
+}
+
+// Calls handler(message stream) for every complete message received so far
+template <typename Handler>
+void receiveMessages(QTcpSocket *socket, Handler handler)
+{
+    QDataStream stream(socket);
+    stream.setVersion(QDataStream::Qt_5_0);
+    while (true) {
+        stream.startTransaction();
+        QByteArray message;
+        stream >> message;
+        if (!stream.commitTransaction())
+            return;
+
+        QDataStream messageStream(message);
+        messageStream.setVersion(QDataStream::Qt_5_0);
+        handler(messageStream);
+    }
+}
+
+#endif // MESSAGES_H
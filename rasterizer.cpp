@@ -0,0 +1,530 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rasterizer.h"
+#include "parallel.h"
+#include "spatialgrid.h"
+
+#include <QTransform>
+#include <atomic>
+#include <math.h>
+
+using namespace std;
+
+TiledShape::TiledShape() :
+    m_gridColumns(0),
+    m_firstColumn(0),
+    m_firstRow(0),
+    m_columns(0)
+{
+}
+
+TiledShape::TiledShape(const Shape &shape, const SpatialGrid &grid, const vector<char> *usedCells) :
+    m_gridColumns(grid.columns())
+{
+    int size = grid.cellSize();
+    QRectF bounds = shape.bounds.translated(-grid.area().topLeft());
+    m_firstColumn = qBound(0, int(floor(bounds.left() / size)), grid.columns() - 1);
+    m_firstRow = qBound(0, int(floor(bounds.top() / size)), grid.rows() - 1);
+    m_columns = qBound(0, int(floor(bounds.right() / size)), grid.columns() - 1) - m_firstColumn + 1;
+    int rows = qBound(0, int(floor(bounds.bottom() / size)), grid.rows() - 1) - m_firstRow + 1;
+    m_edges.resize(m_columns * rows);
+    m_carry.resize(m_columns * rows);
+
+    // Parts of the edges within each row of cells, along with the first
+    // column right of them
+    struct Piece
+    {
+        QPointF top;
+        QPointF bottom;
+        float direction;
+        int carryColumn;
+    };
+    vector<vector<Piece> > pieces(rows);
+
+    QPointF origin = grid.area().topLeft();
+    for (const QPolygonF &polygon : shape.polygons) {
+        int count = polygon.count();
+        if (count < 2)
+            continue;
+        for (int i = 0; i < count; i++) {
+            QPointF p0 = polygon.at(i) - origin, p1 = polygon.at((i + 1) % count) - origin;
+            if (p0.y() == p1.y())
+                continue;
+            float direction = p0.y() < p1.y() ? 1.0f : -1.0f;
+            QPointF top = p0.y() < p1.y() ? p0 : p1;
+            QPointF bottom = p0.y() < p1.y() ? p1 : p0;
+            qreal dxdy = (bottom.x() - top.x()) / (bottom.y() - top.y());
+
+            int firstRow = qMax(m_firstRow, int(floor(top.y() / size)));
+            int lastRow = qMin(m_firstRow + rows - 1, int(ceil(bottom.y() / size)) - 1);
+            for (int row = firstRow; row <= lastRow; row++) {
+                Piece piece;
+                piece.direction = direction;
+                piece.top = top;
+                piece.bottom = bottom;
+                if (top.y() < row * size)
+                    piece.top = QPointF(top.x() + (row * size - top.y()) * dxdy, row * size);
+                if (bottom.y() > (row + 1) * size)
+                    piece.bottom = QPointF(top.x() + ((row + 1) * size - top.y()) * dxdy, (row + 1) * size);
+
+                int first = int(floor(qMin(piece.top.x(), piece.bottom.x()) / size)) - m_firstColumn;
+                int last = int(floor(qMax(piece.top.x(), piece.bottom.x()) / size)) - m_firstColumn;
+                piece.carryColumn = qMax(0, last + 1);
+                for (int column = qMax(0, first); column <= qMin(m_columns - 1, last); column++) {
+                    int cell = (row - m_firstRow) * m_columns + column;
+                    if (!usedCells || (*usedCells)[row * m_gridColumns + m_firstColumn + column]) {
+                        QPointF from = (direction > 0.0f ? piece.top : piece.bottom) + origin;
+                        QPointF to = (direction > 0.0f ? piece.bottom : piece.top) + origin;
+                        m_edges[cell].push_back(QLineF(from, to));
+                    }
+                }
+                if (piece.carryColumn < m_columns)
+                    pieces[row - m_firstRow].push_back(piece);
+            }
+        }
+    }
+
+    // The winding of a piece is added to every cell right of it. The
+    // differences between neighbouring columns are summed up along the row.
+    vector<float> carryDelta;
+    vector<float> carry;
+    for (int row = 0; row < rows; row++) {
+        if (pieces[row].empty())
+            continue;
+        qreal top = (m_firstRow + row) * size;
+        carryDelta.assign(m_columns * size, 0.0f);
+        for (const Piece &piece : pieces[row]) {
+            float *delta = carryDelta.data() + piece.carryColumn * size;
+            float y0 = piece.top.y() - top, y1 = piece.bottom.y() - top;
+            int lastLine = qMin(size, int(ceil(y1)));
+            for (int y = qMax(0, int(floor(y0))); y < lastLine; y++)
+                delta[y] += piece.direction * (min(float(y + 1), y1) - max(float(y), y0));
+        }
+        pieces[row] = vector<Piece>();
+
+        carry.assign(size, 0.0f);
+        for (int column = 0; column < m_columns; column++) {
+            bool reached = false;
+            const float *delta = carryDelta.data() + column * size;
+            for (int y = 0; y < size; y++) {
+                carry[y] += delta[y];
+                reached = reached || carry[y] != 0.0f;
+            }
+            int gridCell = (m_firstRow + row) * m_gridColumns + m_firstColumn + column;
+            if (reached && (!usedCells || (*usedCells)[gridCell]))
+                m_carry[row * m_columns + column] = carry;
+        }
+    }
+}
+
+int TiledShape::index(int cell) const
+{
+    int row = cell / m_gridColumns - m_firstRow;
+    int column = cell % m_gridColumns - m_firstColumn;
+    return row * m_columns + column;
+}
+
+Rasterizer::Rasterizer() :
+    m_width(0),
+    m_height(0)
+{
+}
+
+void Rasterizer::fill(const Shape &shape, uchar *bits, int bytesPerLine, const QRect &clip,
+                      const QPoint &origin)
+{
+    if (!begin(shape, clip))
+        return;
+
+    QPointF areaOrigin(m_area.topLeft());
+    for (const QPolygonF &polygon : shape.polygons) {
+        int count = polygon.count();
+        if (count < 2)
+            continue;
+        for (int i = 0; i < count; i++)
+            addLine(polygon.at(i) - areaOrigin, polygon.at((i + 1) % count) - areaOrigin);
+    }
+    composite(shape, bits, bytesPerLine, origin);
+}
+
+void Rasterizer::fill(const Shape &shape, const TiledShape &tiles, int cell, uchar *bits,
+                      int bytesPerLine, const QRect &clip, const QPoint &origin)
+{
+    if (!begin(shape, clip))
+        return;
+
+    QPointF areaOrigin(m_area.topLeft());
+    for (const QLineF &edge : tiles.edges(cell))
+        addLine(edge.p1() - areaOrigin, edge.p2() - areaOrigin);
+
+    // The edges on the left act like vertical lines along the left edge
+    const vector<float> &carry = tiles.carry(cell);
+    if (!carry.empty()) {
+        for (int y = 0; y < m_height; y++)
+            m_cells[y * (m_width + 2)] += carry[m_area.y() - clip.y() + y];
+    }
+    composite(shape, bits, bytesPerLine, origin);
+}
+
+bool Rasterizer::begin(const Shape &shape, const QRect &clip)
+{
+    m_area = shape.bounds.toAlignedRect() & clip;
+    if (m_area.isEmpty())
+        return false;
+
+    m_width = m_area.width();
+    m_height = m_area.height();
+    m_cells.assign((m_width + 2) * m_height, 0.0f);
+    return true;
+}
+
+void Rasterizer::composite(const Shape &shape, uchar *bits, int bytesPerLine, const QPoint &origin)
+{
+    int gray = qGray(shape.color);
+    bool oddEven = shape.fillRule == Qt::OddEvenFill;
+    for (int y = 0; y < m_height; y++) {
+        const float *cells = m_cells.data() + y * (m_width + 2);
+        uchar *line = bits + (m_area.y() - origin.y() + y) * bytesPerLine + m_area.x() - origin.x();
+        float accumulation = 0.0f;
+
+        for (int x = 0; x < m_width; x++) {
+            accumulation += cells[x];
+            float coverage = fabs(accumulation);
+            if (oddEven) {
+                coverage = fmod(coverage, 2.0f);
+                if (coverage > 1.0f)
+                    coverage = 2.0f - coverage;
+            } else if (coverage > 1.0f) {
+                coverage = 1.0f;
+            }
+
+            if (coverage > 0.0f)
+                line[x] = line[x] + (gray - line[x]) * coverage * shape.opacity + 0.5f;
+        }
+    }
+}
+
+void Rasterizer::addLine(QPointF p0, QPointF p1)
+{
+    if (p0.y() == p1.y())
+        return;
+
+    // Split the line where it crosses the left or right edge of the area. The parts
+    // outside are clamped onto the edge, where they turn into vertical lines which
+    // still contribute the right winding to everything on their right side.
+    const qreal edges[] = { 0.0, qreal(m_width) };
+    for (qreal edge : edges) {
+        if ((p0.x() < edge && p1.x() > edge) || (p0.x() > edge && p1.x() < edge)) {
+            qreal t = (edge - p0.x()) / (p1.x() - p0.x());
+            QPointF crossing(edge, p0.y() + t * (p1.y() - p0.y()));
+            addLine(p0, crossing);
+            addLine(crossing, p1);
+            return;
+        }
+    }
+
+    p0.setX(qBound<qreal>(0.0, p0.x(), m_width));
+    p1.setX(qBound<qreal>(0.0, p1.x(), m_width));
+    accumulateLine(p0, p1);
+}
+
+void Rasterizer::accumulateLine(const QPointF &from, const QPointF &to)
+{
+    float direction = from.y() < to.y() ? 1.0f : -1.0f;
+    const QPointF &p0 = from.y() < to.y() ? from : to;
+    const QPointF &p1 = from.y() < to.y() ? to : from;
+
+    float dxdy = (p1.x() - p0.x()) / (p1.y() - p0.y());
+    float x = p0.x();
+    if (p0.y() < 0.0)
+        x -= p0.y() * dxdy;
+
+    int stride = m_width + 2;
+    int lastLine = min(m_height, int(ceil(p1.y())));
+    for (int y = max(0, int(floor(p0.y()))); y < lastLine; y++) {
+        float *cells = m_cells.data() + y * stride;
+        float dy = min(float(y + 1), float(p1.y())) - max(float(y), float(p0.y()));
+        float xNext = x + dxdy * dy;
+        float d = dy * direction;
+
+        // Clamp away rounding errors which could step outside the cell row
+        float x0 = max(0.0f, min(x, xNext));
+        float x1 = min(float(m_width), max(x, xNext));
+        float x0Floor = floor(x0);
+        int x0i = x0Floor;
+        float x1Ceil = ceil(x1);
+        int x1i = x1Ceil;
+
+        if (x1i <= x0i + 1) {
+            // The line stays within a single cell on this scanline
+            float xMid = 0.5f * (x + xNext) - x0Floor;
+            cells[x0i] += d - d * xMid;
+            cells[x0i + 1] += d * xMid;
+        } else {
+            float s = 1.0f / (x1 - x0);
+            float x0f = x0 - x0Floor;
+            float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+            float x1f = x1 - x1Ceil + 1.0f;
+            float am = 0.5f * s * x1f * x1f;
+            cells[x0i] += d * a0;
+            if (x1i == x0i + 2) {
+                cells[x0i + 1] += d * (1.0f - a0 - am);
+            } else {
+                float a1 = s * (1.5f - x0f);
+                cells[x0i + 1] += d * (a1 - a0);
+                for (int xi = x0i + 2; xi < x1i - 1; xi++)
+                    cells[xi] += d * s;
+                float a2 = a1 + (x1i - x0i - 3) * s;
+                cells[x1i - 1] += d * (1.0f - a2 - am);
+            }
+            cells[x1i] += d * am;
+        }
+        x = xNext;
+    }
+}
+
+// Indexes the shapes by the tiles of the target they overlap
+static SpatialGrid tileGrid(const QVector<Shape> &shapes, const QRect &area, int tileSize)
+{
+    SpatialGrid grid(area, tileSize);
+    for (int shape = 0; shape < shapes.count(); shape++)
+        grid.insert(shape, shapes.at(shape).bounds);
+    return grid;
+}
+
+// Calls function(threadId, tile, shapeIndices) for every tile of the grid which
+// some shapes overlap, handing out the tiles to numThreads threads
+template <typename Function>
+static void forEachTile(const SpatialGrid &grid, int numThreads, Function function)
+{
+    atomic<int> nextTile(0);
+    runThreads(numThreads, [&](int threadId) {
+        for (int tile = nextTile++; tile < grid.cellCount(); tile = nextTile++) {
+            if (!grid.items(tile).isEmpty())
+                function(threadId, tile, grid.items(tile));
+        }
+    });
+}
+
+// Tiles the shapes spanning more than one cell of the grid, leaving the
+// others null
+static vector<TiledShape> tileShapes(const QVector<Shape> &shapes, const SpatialGrid &grid,
+                                     int numThreads, const vector<char> *usedCells = nullptr)
+{
+    vector<TiledShape> tiled(shapes.count());
+    atomic<int> nextShape(0);
+    runThreads(numThreads, [&](int) {
+        for (int shape = nextShape++; shape < shapes.count(); shape = nextShape++) {
+            const QRectF &bounds = shapes.at(shape).bounds;
+            int firstCell = grid.cellAt(bounds.topLeft());
+            if (firstCell < 0 || firstCell != grid.cellAt(bounds.bottomRight()))
+                tiled[shape] = TiledShape(shapes.at(shape), grid, usedCells);
+        }
+    });
+    return tiled;
+}
+
+void rasterizeShapes(const QVector<Shape> &shapes, QImage *target, int numThreads)
+{
+    uchar *bits = target->bits();
+    int bytesPerLine = target->bytesPerLine();
+
+    SpatialGrid grid = tileGrid(shapes, target->rect(), 128);
+    vector<TiledShape> tiled = tileShapes(shapes, grid, numThreads);
+    vector<Rasterizer> rasterizers(numThreads);
+    forEachTile(grid, numThreads, [&](int threadId, int tile, const QVector<int> &indices) {
+        QRect rect = grid.cellRect(tile);
+        for (int index : indices) {
+            if (tiled[index].isNull())
+                rasterizers[threadId].fill(shapes.at(index), bits, bytesPerLine, rect);
+            else
+                rasterizers[threadId].fill(shapes.at(index), tiled[index], tile, bits, bytesPerLine, rect);
+        }
+    });
+}
+
+void paintShapes(const QVector<Shape> &shapes, QImage *target, int numThreads)
+{
+    uchar *bits = target->bits();
+    int bytesPerLine = target->bytesPerLine();
+    int bytesPerPixel = target->depth() / 8;
+
+    SpatialGrid grid = tileGrid(shapes, target->rect(), 128);
+    forEachTile(grid, numThreads, [&](int, int cell, const QVector<int> &indices) {
+        QRect tile = grid.cellRect(cell);
+        // Paint through an image sharing the memory of the tile
+        QImage view(bits + tile.y() * bytesPerLine + tile.x() * bytesPerPixel,
+                    tile.width(), tile.height(), bytesPerLine, target->format());
+        QPainter painter(&view);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(-tile.x(), -tile.y());
+        painter.setPen(Qt::NoPen);
+
+        for (int index : indices) {
+            const Shape &shape = shapes.at(index);
+            QPainterPath path;
+            path.setFillRule(shape.fillRule);
+            for (const QPolygonF &polygon : shape.polygons)
+                path.addPolygon(polygon);
+            painter.setOpacity(shape.opacity);
+            painter.fillPath(path, QColor(shape.color));
+        }
+    });
+}
+
+// Marks the cells of a grid of tileSize cells which the line crosses
+static void markCrossedTiles(QPointF p0, QPointF p1, int tileSize, int columns, int rows,
+                             vector<char> *crossed)
+{
+    // Clip the line to the grid so that the walk stays within it: the part
+    // at t in [t0, t1] satisfies direction[i] * t <= room[i] on all sides
+    QPointF delta = p1 - p0;
+    const qreal direction[] = { -delta.x(), delta.x(), -delta.y(), delta.y() };
+    const qreal room[] = { p0.x(), columns * tileSize - p0.x(), p0.y(), rows * tileSize - p0.y() };
+    qreal t0 = 0.0, t1 = 1.0;
+    for (int side = 0; side < 4; side++) {
+        if (direction[side] == 0.0) {
+            if (room[side] < 0.0)
+                return;
+        } else if (direction[side] < 0.0) {
+            t0 = qMax(t0, room[side] / direction[side]);
+        } else {
+            t1 = qMin(t1, room[side] / direction[side]);
+        }
+    }
+    if (t0 > t1)
+        return;
+
+    // Walk the cells along the line in tile units
+    qreal x = (p0.x() + t0 * delta.x()) / tileSize, y = (p0.y() + t0 * delta.y()) / tileSize;
+    qreal endX = (p0.x() + t1 * delta.x()) / tileSize, endY = (p0.y() + t1 * delta.y()) / tileSize;
+    int column = qBound(0, int(floor(x)), columns - 1), row = qBound(0, int(floor(y)), rows - 1);
+    int lastColumn = qBound(0, int(floor(endX)), columns - 1), lastRow = qBound(0, int(floor(endY)), rows - 1);
+    int stepX = endX > x ? 1 : -1, stepY = endY > y ? 1 : -1;
+    qreal dx = fabs(endX - x), dy = fabs(endY - y);
+    qreal nextX = dx > 0.0 ? (stepX > 0 ? column + 1 - x : x - column) / dx : 2.0;
+    qreal nextY = dy > 0.0 ? (stepY > 0 ? row + 1 - y : y - row) / dy : 2.0;
+
+    (*crossed)[row * columns + column] = true;
+    int steps = qAbs(lastColumn - column) + qAbs(lastRow - row);
+    for (int step = 0; step < steps; step++) {
+        if (nextX < nextY) {
+            column += stepX;
+            nextX += 1.0 / dx;
+        } else {
+            row += stepY;
+            nextY += 1.0 / dy;
+        }
+        column = qBound(0, column, columns - 1);
+        row = qBound(0, row, rows - 1);
+        (*crossed)[row * columns + column] = true;
+    }
+}
+
+RunLengthMask rasterizeAdaptive(const QVector<Shape> &shapes, const QSize &size, uchar background,
+                                int tileSize, int numThreads)
+{
+    int columns = (size.width() + tileSize - 1) / tileSize;
+    int rows = (size.height() + tileSize - 1) / tileSize;
+
+    vector<char> crossed(columns * rows, false);
+    for (const Shape &shape : shapes) {
+        for (const QPolygonF &polygon : shape.polygons) {
+            int count = polygon.count();
+            if (count < 2)
+                continue;
+            for (int i = 0; i < count; i++)
+                markCrossedTiles(polygon.at(i), polygon.at((i + 1) % count), tileSize, columns, rows, &crossed);
+        }
+    }
+
+    // Each shape covers the tiles no edge crosses either entirely or not at all
+    QVector<Shape> coarseShapes = mapShapes(shapes, QTransform::fromScale(1.0 / tileSize, 1.0 / tileSize));
+    QImage coarse(columns, rows, QImage::Format_Grayscale8);
+    coarse.fill(background);
+    rasterizeShapes(coarseShapes, &coarse, numThreads);
+    coarseShapes.clear();
+
+    SpatialGrid grid = tileGrid(shapes, QRect(QPoint(0, 0), size), tileSize);
+    vector<TiledShape> tiled = tileShapes(shapes, grid, numThreads, &crossed);
+
+    // Tile rows are handed out to the threads, which walk their tiles from
+    // left to right appending the transitions of the pixel rows
+    vector<char> startsInside(size.height());
+    vector<vector<int> > transitions(size.height());
+    atomic<int> nextRow(0);
+    runThreads(numThreads, [&](int) {
+        Rasterizer rasterizer;
+        vector<uchar> tile(tileSize * tileSize);
+        for (int row = nextRow++; row < rows; row = nextRow++) {
+            int top = row * tileSize;
+            int height = qMin(tileSize, size.height() - top);
+            vector<char> inside(height);
+            for (int column = 0; column < columns; column++) {
+                int left = column * tileSize;
+                int width = qMin(tileSize, size.width() - left);
+                int cell = row * columns + column;
+
+                if (!crossed[cell]) {
+                    bool uniformInside = coarse.constScanLine(row)[column] >= 128;
+                    for (int y = 0; y < height; y++) {
+                        if (column == 0)
+                            inside[y] = startsInside[top + y] = uniformInside;
+                        else if (inside[y] != uniformInside)
+                            transitions[top + y].push_back(left);
+                        inside[y] = uniformInside;
+                    }
+                    continue;
+                }
+
+                // The tile's buffer starts at its top left pixel
+                QRect rect(left, top, width, height);
+                fill(tile.begin(), tile.end(), background);
+                for (int index : grid.items(cell)) {
+                    if (tiled[index].isNull())
+                        rasterizer.fill(shapes.at(index), tile.data(), tileSize, rect, rect.topLeft());
+                    else
+                        rasterizer.fill(shapes.at(index), tiled[index], cell, tile.data(), tileSize, rect,
+                                        rect.topLeft());
+                }
+
+                for (int y = 0; y < height; y++) {
+                    const uchar *line = tile.data() + y * tileSize;
+                    for (int x = 0; x < width; x++) {
+                        bool pixelInside = line[x] >= 128;
+                        if (column == 0 && x == 0)
+                            inside[y] = startsInside[top + y] = pixelInside;
+                        else if (inside[y] != pixelInside)
+                            transitions[top + y].push_back(left + x);
+                        inside[y] = pixelInside;
+                    }
+                }
+            }
+        }
+    });
+
+    return RunLengthMask(size.width(), startsInside, transitions);
+}
@@ -0,0 +1,119 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include "runlength.h"
+#include "shape.h"
+#include "spatialgrid.h"
+
+#include <QImage>
+#include <QLineF>
+#include <QPainter>
+#include <QRect>
+#include <vector>
+
+// Edges of a shape sorted into the cells of a grid it spans. Each cell gets
+// the edges crossing it and the winding that the edges on its left add to
+// each of its scanlines, so a cell can be rasterized without walking the
+// rest of the shape. Only the cells flagged in usedCells are filled in when
+// it's given.
+class TiledShape
+{
+public:
+    TiledShape();
+    TiledShape(const Shape &shape, const SpatialGrid &grid, const std::vector<char> *usedCells = nullptr);
+
+    bool isNull() const { return m_edges.empty(); }
+
+    const std::vector<QLineF> &edges(int cell) const { return m_edges.at(index(cell)); }
+    // Empty if no winding reaches the cell from the left
+    const std::vector<float> &carry(int cell) const { return m_carry.at(index(cell)); }
+
+private:
+    int index(int cell) const;
+
+    int m_gridColumns;
+    int m_firstColumn;
+    int m_firstRow;
+    int m_columns;
+    std::vector<std::vector<QLineF> > m_edges;
+    std::vector<std::vector<float> > m_carry;
+};
+
+// Scanline rasterizer computing exact area coverage by accumulating the
+// signed area each polygon edge covers in a cell and summing the cells up
+// along the scanline. Each instance keeps its own scratch buffer, so tiles
+// of the same image can be rasterized concurrently with one instance per
+// thread.
+class Rasterizer
+{
+public:
+    Rasterizer();
+
+    // Composites the shape over an 8-bit gray buffer, touching only the
+    // pixels inside clip. The first pixel of the buffer is the one at origin,
+    // and the clip rectangle must lie within the buffer.
+    void fill(const Shape &shape, uchar *bits, int bytesPerLine, const QRect &clip,
+              const QPoint &origin = QPoint());
+
+    // Like fill(), but only visits the edges of the shape crossing the given
+    // cell of the grid it was tiled on. clip must be the rectangle of the cell.
+    void fill(const Shape &shape, const TiledShape &tiles, int cell, uchar *bits, int bytesPerLine,
+              const QRect &clip, const QPoint &origin = QPoint());
+
+private:
+    bool begin(const Shape &shape, const QRect &clip);
+    void composite(const Shape &shape, uchar *bits, int bytesPerLine, const QPoint &origin);
+    void addLine(QPointF p0, QPointF p1);
+    void accumulateLine(const QPointF &from, const QPointF &to);
+
+    std::vector<float> m_cells;
+    QRect m_area;
+    int m_width;
+    int m_height;
+};
+
+// Composites the shapes in order over the Format_Grayscale8 target. The target
+// is split into tiles processed on numThreads threads, and the shapes are
+// indexed by their bounds first so that each tile only visits the shapes
+// overlapping it. Shapes spanning several tiles are tiled first, so each
+// tile only walks the edges crossing it.
+void rasterizeShapes(const QVector<Shape> &shapes, QImage *target, int numThreads);
+
+// Like rasterizeShapes(), but fills the tiles with QPainter.
+void paintShapes(const QVector<Shape> &shapes, QImage *target, int numThreads);
+
+// Composites the shapes in order over a buffer of the given size filled with
+// background, thresholded at mid-gray. The tiles of tileSize pixels which no
+// polygon edge crosses are uniform, so their value is taken from a coarse
+// rendering with a pixel per tile. Only the tiles along the edges are
+// rasterized at full size, one at a time, so memory and time follow the
+// length of the edges rather than the area of the buffer.
+RunLengthMask rasterizeAdaptive(const QVector<Shape> &shapes, const QSize &size, uchar background,
+                                int tileSize, int numThreads);
+
+#endif // RASTERIZER_H
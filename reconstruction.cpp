@@ -0,0 +1,95 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "reconstruction.h"
+#include "parallel.h"
+
+#include <atomic>
+
+using namespace std;
+
+ReconstructionCheck::ReconstructionCheck(const QImage &source, const QRect &area, bool negate,
+                                         const QSize &displaySize) :
+    m_outlineLength(0)
+{
+    // 255 marks the inside of the shape
+    m_reference = source.copy(area).scaled(displaySize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    for (int y = 0; y < m_reference.height(); y++) {
+        uchar *line = m_reference.scanLine(y);
+        for (int x = 0; x < m_reference.width(); x++)
+            line[x] = (line[x] >= 128) == negate ? 255 : 0;
+    }
+
+    // Pixels with a horizontal or vertical neighbour on the other side
+    for (int y = 0; y < m_reference.height(); y++) {
+        const uchar *line = m_reference.constScanLine(y);
+        const uchar *nextLine = y + 1 < m_reference.height() ? m_reference.constScanLine(y + 1) : nullptr;
+        for (int x = 0; x < m_reference.width(); x++) {
+            if (x + 1 < m_reference.width() && line[x] != line[x + 1])
+                m_outlineLength++;
+            if (nextLine && line[x] != nextLine[x])
+                m_outlineLength++;
+        }
+    }
+}
+
+qreal ReconstructionCheck::error(const QImage &field, int numThreads) const
+{
+    int width = m_reference.width();
+    int height = m_reference.height();
+    qreal xScale = qreal(field.width()) / width;
+    qreal yScale = qreal(field.height()) / height;
+    int lastX = field.width() - 1;
+    int lastY = field.height() - 1;
+    atomic<int> mismatches(0);
+
+    runThreads(numThreads, [&](int threadId) {
+        int count = 0;
+        for (int y = threadId; y < height; y += numThreads) {
+            const uchar *reference = m_reference.constScanLine(y);
+            qreal fy = qBound<qreal>(0.0, (y + 0.5) * yScale - 0.5, lastY);
+            int y0 = int(fy);
+            int y1 = qMin(y0 + 1, lastY);
+            float ty = fy - y0;
+            const uchar *line0 = field.constScanLine(y0);
+            const uchar *line1 = field.constScanLine(y1);
+
+            for (int x = 0; x < width; x++) {
+                qreal fx = qBound<qreal>(0.0, (x + 0.5) * xScale - 0.5, lastX);
+                int x0 = int(fx);
+                int x1 = qMin(x0 + 1, lastX);
+                float tx = fx - x0;
+                float top = line0[x0] + (line0[x1] - line0[x0]) * tx;
+                float bottom = line1[x0] + (line1[x1] - line1[x0]) * tx;
+                bool inside = top + (bottom - top) * ty >= 127.5f;
+                if (inside != (reference[x] == 255))
+                    count++;
+            }
+        }
+        mismatches += count;
+    });
+
+    return qreal(mismatches) / qMax(1, m_outlineLength);
+}
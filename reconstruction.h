@@ -0,0 +1,53 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RECONSTRUCTION_H
+#define RECONSTRUCTION_H
+
+#include <QImage>
+#include <QRect>
+
+// Checks how faithfully a distance field reproduces the shape when it's
+// rendered the way tester.qml renders it: sampled bilinearly and thresholded
+// at mid-gray. The reference is the source buffer itself, downscaled to the
+// display size and thresholded the way the distance search does.
+class ReconstructionCheck
+{
+public:
+    // area is the unpadded part of the Format_Grayscale8 source
+    ReconstructionCheck(const QImage &source, const QRect &area, bool negate,
+                        const QSize &displaySize);
+
+    // Returns the area of the pixels where the reconstruction differs from the
+    // reference divided by the length of the reference outline, which is the
+    // mean displacement of the edges in display pixels.
+    qreal error(const QImage &field, int numThreads) const;
+
+private:
+    QImage m_reference;
+    int m_outlineLength;
+};
+
+#endif // RECONSTRUCTION_H
@@ -0,0 +1,182 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "runlength.h"
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <atomic>
+
+using namespace std;
+
+// Horizontal offset of rows without a pixel on the wanted side within reach
+static const int unreached = 1 << 20;
+
+RunLengthMask::RunLengthMask(const QImage &image, int numThreads) :
+    m_width(image.width()),
+    m_startsInside(image.height())
+{
+    // Collect the transitions of interleaved rows on each thread, then
+    // concatenate them in row order
+    vector<vector<int> > rows(image.height());
+    runThreads(numThreads, [&](int threadId) {
+        for (int y = threadId; y < image.height(); y += numThreads) {
+            const uchar *line = image.constScanLine(y);
+            bool inside = m_width > 0 && line[0] >= 128;
+            m_startsInside[y] = inside;
+            for (int x = 1; x < m_width; x++) {
+                if ((line[x] >= 128) != inside) {
+                    rows[y].push_back(x);
+                    inside = !inside;
+                }
+            }
+        }
+    });
+
+    setRows(rows);
+}
+
+RunLengthMask::RunLengthMask(int width, const vector<char> &startsInside, const vector<vector<int> > &rows) :
+    m_width(width),
+    m_startsInside(startsInside)
+{
+    setRows(rows);
+}
+
+void RunLengthMask::setRows(const vector<vector<int> > &rows)
+{
+    size_t count = 0;
+    for (const vector<int> &row : rows)
+        count += row.size();
+
+    m_rowStarts.reserve(rows.size() + 1);
+    m_rowStarts.push_back(0);
+    m_transitions.reserve(count);
+    for (const vector<int> &row : rows) {
+        m_transitions.insert(m_transitions.end(), row.begin(), row.end());
+        m_rowStarts.push_back(m_transitions.size());
+    }
+}
+
+void runLengthDistanceField(const RunLengthMask &mask, int searchRadius, QImage *field, int numThreads,
+                            QImage *gradient, const QPoint &origin)
+{
+    float maxDist = maxDistance(searchRadius);
+    QSize imageSize = field->size();
+    int bandHeight = qMax(64, searchRadius * 4);
+    int bandCount = (imageSize.height() + bandHeight - 1) / bandHeight;
+
+    atomic<int> nextBand(0);
+    runThreads(numThreads, [&](int) {
+        // Offset to the nearest pixel at or above and below mid-gray in the
+        // same row, for the columns of the field
+        vector<int> toInside, toOutside;
+        for (int band = nextBand++; band < bandCount; band = nextBand++) {
+            int firstLine = band * bandHeight;
+            int lineCount = qMin(bandHeight, imageSize.height() - firstLine);
+            int maskLines = lineCount + searchRadius * 2;
+            int width = imageSize.width();
+            toInside.assign(width * maskLines, unreached);
+            toOutside.assign(width * maskLines, unreached);
+
+            for (int y = 0; y < maskLines; y++) {
+                int maskY = origin.y() + firstLine + y;
+                const int *transitions = mask.transitions(maskY);
+                int count = mask.transitionCount(maskY);
+                bool inside = mask.startsInside(maskY);
+                int *insideLine = toInside.data() + y * width;
+                int *outsideLine = toOutside.data() + y * width;
+
+                // Fill in the columns of each run from its ends, which border
+                // the runs of the other side
+                for (int run = 0; run <= count; run++, inside = !inside) {
+                    int runStart = run > 0 ? transitions[run - 1] : 0;
+                    int runEnd = run < count ? transitions[run] : mask.width();
+                    int left = origin.x() + searchRadius;
+                    int first = qMax(runStart, left);
+                    int last = qMin(runEnd, left + width);
+                    int *same = inside ? insideLine : outsideLine;
+                    int *other = inside ? outsideLine : insideLine;
+                    for (int x = first; x < last; x++) {
+                        int before = run > 0 ? runStart - 1 - x : -unreached;
+                        int after = run < count ? runEnd - x : unreached;
+                        int offset = -before <= after ? before : after;
+                        same[x - left] = 0;
+                        other[x - left] = qAbs(offset) <= searchRadius ? offset : unreached;
+                    }
+                }
+            }
+
+            for (int y = 0; y < lineCount; y++) {
+                int maskY = y + searchRadius;
+                const int *insideRow = toInside.data() + maskY * width;
+                uchar *fieldLine = field->scanLine(firstLine + y);
+                QRgba64 *gradientLine = gradient
+                        ? reinterpret_cast<QRgba64 *>(gradient->scanLine(firstLine + y)) : nullptr;
+
+                for (int x = 0; x < width; x++) {
+                    bool inside = insideRow[x] == 0;
+                    const int *other = (inside ? toOutside.data() : toInside.data()) + maskY * width + x;
+
+                    // Rows farther than the best distance so far can't hold a
+                    // nearer pixel. Ties go to the pixel the window search
+                    // would visit first, so that the gradients agree as well.
+                    int nearestDx = 0, nearestDy = 0;
+                    int nearestSquared = -1;
+                    for (int distance = 0; distance <= searchRadius; distance++) {
+                        if (nearestSquared >= 0 && distance * distance > nearestSquared)
+                            break;
+                        for (int dy = -distance; dy <= distance; dy += qMax(1, distance * 2)) {
+                            int dx = other[dy * width];
+                            if (dx == unreached)
+                                continue;
+                            int squared = dx * dx + dy * dy;
+                            if (nearestSquared < 0 || squared < nearestSquared
+                                    || (squared == nearestSquared && dy < nearestDy)) {
+                                nearestSquared = squared;
+                                nearestDx = dx;
+                                nearestDy = dy;
+                            }
+                        }
+                    }
+
+                    float minDistance = nearestSquared < 0 ? maxDist : sqrt(float(nearestSquared));
+                    if (gradientLine) {
+                        // The field grows towards dark pixels
+                        if (nearestSquared < 0 || minDistance > maxDist) {
+                            gradientLine[x] = encodeGradient(0.0, 0.0);
+                        } else {
+                            qreal dx = nearestDx / minDistance;
+                            qreal dy = nearestDy / minDistance;
+                            gradientLine[x] = inside ? encodeGradient(dx, dy) : encodeGradient(-dx, -dy);
+                        }
+                    }
+
+                    fieldLine[x] = encodeDistance(inside ? -minDistance : minDistance, maxDist);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,74 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RUNLENGTH_H
+#define RUNLENGTH_H
+
+#include <QImage>
+#include <vector>
+
+// Rows of a Format_Grayscale8 image thresholded at mid-gray, stored as the x
+// coordinates at which each row switches sides. Shapes made of long runs of
+// a single side take a few integers per row instead of a byte per pixel.
+class RunLengthMask
+{
+public:
+    RunLengthMask(const QImage &image, int numThreads);
+    // Takes the transitions of each row, and whether it starts at or above mid-gray
+    RunLengthMask(int width, const std::vector<char> &startsInside,
+                  const std::vector<std::vector<int> > &rows);
+
+    int width() const { return m_width; }
+    int height() const { return int(m_rowStarts.size()) - 1; }
+    qint64 transitionCount() const { return m_transitions.size(); }
+
+    // Whether the row starts at or above mid-gray
+    bool startsInside(int y) const { return m_startsInside[y]; }
+
+    // The transitions of the row in increasing order, each the x coordinate
+    // of the first pixel after the switch
+    const int *transitions(int y) const { return m_transitions.data() + m_rowStarts[y]; }
+    int transitionCount(int y) const { return m_rowStarts[y + 1] - m_rowStarts[y]; }
+
+private:
+    void setRows(const std::vector<std::vector<int> > &rows);
+
+    int m_width;
+    std::vector<char> m_startsInside;
+    std::vector<int> m_rowStarts;
+    std::vector<int> m_transitions;
+};
+
+// Computes the field bruteForceDistanceField() does out of the padded mask.
+// A first pass finds the nearest pixel on either side within each row from
+// the transitions, and a second pass combines the rows within the search
+// radius, visiting them in order of distance until no nearer pixel can turn
+// up. The distances are the same as those of the window search. If origin
+// is given, the field holds the part of the full field starting there, and
+// the mask only has to reach searchRadius pixels beyond that part.
+void runLengthDistanceField(const RunLengthMask &mask, int searchRadius, QImage *field, int numThreads,
+                            QImage *gradient = nullptr, const QPoint &origin = QPoint());
+
+#endif // RUNLENGTH_H
@@ -0,0 +1,328 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sdfcodec.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+static const unsigned char magic[4] = { 'S', 'D', 'F', '1' };
+
+// Each band of rows holds about this many texels
+static const int bandTexels = 1 << 16;
+
+static const int contextCount = 4;
+
+// rANS coding with 12-bit probabilities and a 32-bit state renormalized bytewise
+static const int probabilityBits = 12;
+static const uint32_t probabilityScale = 1 << probabilityBits;
+static const uint32_t stateLowerBound = 1 << 23;
+
+// Predicts a texel from its left, upper and upper left neighbours
+static inline int predict(int w, int n, int nw)
+{
+    if (nw >= max(w, n))
+        return min(w, n);
+    if (nw <= min(w, n))
+        return max(w, n);
+    return w + n - nw;
+}
+
+// Picks the frequency table for a texel by how steep the field is around it
+static inline int context(int w, int n, int nw)
+{
+    int activity = abs(w - nw) + abs(n - nw);
+    return activity == 0 ? 0 : activity <= 4 ? 1 : activity <= 16 ? 2 : 3;
+}
+
+// Calls function(x, y, prediction, context) for the texels of the rows
+// [top, bottom) in order. value(x, y) has to return the texels already visited.
+// The first row of a band is predicted from the left neighbours only, so that
+// bands don't depend on each other.
+template <typename Value, typename Function>
+static void visitBand(int width, int top, int bottom, Value value, Function function)
+{
+    for (int y = top; y < bottom; y++) {
+        for (int x = 0; x < width; x++) {
+            int w, n, nw;
+            if (y == top) {
+                w = x > 0 ? value(x - 1, y) : 0;
+                n = nw = w;
+            } else {
+                n = value(x, y - 1);
+                w = x > 0 ? value(x - 1, y) : n;
+                nw = x > 0 ? value(x - 1, y - 1) : n;
+            }
+            function(x, y, predict(w, n, nw), context(w, n, nw));
+        }
+    }
+}
+
+// Scales the symbol counts so that they sum up to probabilityScale, keeping
+// every symbol which occurs at least at a frequency of 1
+static void normalizeFrequencies(const uint32_t *counts, uint32_t *frequencies)
+{
+    uint64_t total = 0;
+    for (int symbol = 0; symbol < 256; symbol++)
+        total += counts[symbol];
+
+    if (total == 0) {
+        fill(frequencies, frequencies + 256, 0);
+        return;
+    }
+
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int symbol = 0; symbol < 256; symbol++) {
+        frequencies[symbol] = counts[symbol] == 0 ? 0 :
+                max<uint32_t>(1, counts[symbol] * uint64_t(probabilityScale) / total);
+        sum += frequencies[symbol];
+        if (frequencies[symbol] > frequencies[largest])
+            largest = symbol;
+    }
+
+    // Settle the rounding error on the most frequent symbol, or take what
+    // doesn't fit from the others if the minimum frequencies overshot
+    if (sum <= probabilityScale || frequencies[largest] > sum - probabilityScale) {
+        frequencies[largest] += probabilityScale - sum;
+    } else {
+        for (int symbol = 0; sum > probabilityScale; symbol = (symbol + 1) % 256) {
+            if (frequencies[symbol] > 1) {
+                frequencies[symbol]--;
+                sum--;
+            }
+        }
+    }
+}
+
+static void writeUint32(vector<unsigned char> *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out->push_back(value >> (i * 8));
+}
+
+static uint32_t readUint32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
+
+// A band is stored as the frequency tables, the number of bytes of the rANS
+// stream and the stream itself
+static vector<unsigned char> encodeBand(const unsigned char *texels, int width, int top, int bottom,
+                                        int bytesPerLine)
+{
+    auto value = [&](int x, int y) { return texels[size_t(y) * bytesPerLine + x]; };
+
+    vector<unsigned char> residuals(width * (bottom - top));
+    vector<unsigned char> contexts(residuals.size());
+    uint32_t counts[contextCount][256] = {};
+    visitBand(width, top, bottom, value, [&](int x, int y, int prediction, int ctx) {
+        int index = (y - top) * width + x;
+        residuals[index] = value(x, y) - prediction;
+        contexts[index] = ctx;
+        counts[ctx][residuals[index]]++;
+    });
+
+    vector<unsigned char> out;
+    uint32_t frequencies[contextCount][256];
+    uint32_t cumulative[contextCount][256];
+    for (int ctx = 0; ctx < contextCount; ctx++) {
+        normalizeFrequencies(counts[ctx], frequencies[ctx]);
+        uint32_t sum = 0;
+        int used = 0;
+        for (int symbol = 0; symbol < 256; symbol++) {
+            cumulative[ctx][symbol] = sum;
+            sum += frequencies[ctx][symbol];
+            used += frequencies[ctx][symbol] > 0 ? 1 : 0;
+        }
+
+        // Only the symbols in use are listed, with 16-bit frequencies
+        out.push_back(used);
+        out.push_back(used >> 8);
+        for (int symbol = 0; symbol < 256; symbol++) {
+            if (frequencies[ctx][symbol] > 0) {
+                out.push_back(symbol);
+                out.push_back(frequencies[ctx][symbol]);
+                out.push_back(frequencies[ctx][symbol] >> 8);
+            }
+        }
+    }
+
+    // rANS encodes backwards, so the decoder can read the stream forwards
+    vector<unsigned char> stream;
+    uint32_t state = stateLowerBound;
+    for (size_t i = residuals.size(); i-- > 0;) {
+        uint32_t frequency = frequencies[contexts[i]][residuals[i]];
+        uint32_t limit = ((stateLowerBound >> probabilityBits) << 8) * frequency;
+        while (state >= limit) {
+            stream.push_back(state & 0xff);
+            state >>= 8;
+        }
+        state = ((state / frequency) << probabilityBits) + state % frequency
+                + cumulative[contexts[i]][residuals[i]];
+    }
+    for (int i = 0; i < 4; i++) {
+        stream.push_back(state & 0xff);
+        state >>= 8;
+    }
+    reverse(stream.begin(), stream.end());
+
+    writeUint32(&out, stream.size());
+    out.insert(out.end(), stream.begin(), stream.end());
+    return out;
+}
+
+static bool decodeBand(const unsigned char *data, size_t size, unsigned char *texels, int width,
+                       int top, int bottom)
+{
+    uint32_t frequencies[contextCount][256] = {};
+    uint32_t cumulative[contextCount][256];
+    unsigned char symbols[contextCount][probabilityScale] = {};
+    size_t pos = 0;
+    for (int ctx = 0; ctx < contextCount; ctx++) {
+        if (pos + 2 > size)
+            return false;
+        int used = data[pos] | (data[pos + 1] << 8);
+        pos += 2;
+        for (int i = 0; i < used; i++) {
+            if (pos + 3 > size)
+                return false;
+            frequencies[ctx][data[pos]] = data[pos + 1] | (data[pos + 2] << 8);
+            pos += 3;
+        }
+
+        uint32_t sum = 0;
+        for (int symbol = 0; symbol < 256; symbol++) {
+            cumulative[ctx][symbol] = sum;
+            if (sum + frequencies[ctx][symbol] > probabilityScale)
+                return false;
+            fill(symbols[ctx] + sum, symbols[ctx] + sum + frequencies[ctx][symbol], symbol);
+            sum += frequencies[ctx][symbol];
+        }
+        if (used > 0 && sum != probabilityScale)
+            return false;
+    }
+
+    if (pos + 4 > size || readUint32(data + pos) > size - pos - 4)
+        return false;
+    const unsigned char *stream = data + pos + 4;
+    const unsigned char *streamEnd = stream + readUint32(data + pos);
+    if (streamEnd - stream < 4)
+        return false;
+
+    uint32_t state = 0;
+    for (int i = 0; i < 4; i++)
+        state = (state << 8) | *stream++;
+
+    bool ok = true;
+    auto value = [&](int x, int y) { return texels[size_t(y) * width + x]; };
+    visitBand(width, top, bottom, value, [&](int x, int y, int prediction, int ctx) {
+        uint32_t slot = state & (probabilityScale - 1);
+        unsigned char residual = symbols[ctx][slot];
+        if (frequencies[ctx][residual] == 0) {
+            ok = false;
+            return;
+        }
+        state = frequencies[ctx][residual] * (state >> probabilityBits) + slot - cumulative[ctx][residual];
+        while (state < stateLowerBound && stream < streamEnd)
+            state = (state << 8) | *stream++;
+        texels[size_t(y) * width + x] = prediction + residual;
+    });
+    return ok;
+}
+
+vector<unsigned char> encodeDistanceField(const unsigned char *texels, int width, int height,
+                                          int bytesPerLine, int numThreads)
+{
+    int bandRows = max(1, bandTexels / max(1, width));
+    int bandCount = (height + bandRows - 1) / bandRows;
+
+    vector<vector<unsigned char>> bands(bandCount);
+    atomic<int> nextBand(0);
+    runThreads(numThreads, [&](int) {
+        for (int band = nextBand++; band < bandCount; band = nextBand++) {
+            bands[band] = encodeBand(texels, width, band * bandRows,
+                                     min(height, (band + 1) * bandRows), bytesPerLine);
+        }
+    });
+
+    // The header lists the sizes of the bands, so that they can be found
+    // without decoding the ones before
+    vector<unsigned char> out(magic, magic + 4);
+    writeUint32(&out, width);
+    writeUint32(&out, height);
+    writeUint32(&out, bandRows);
+    for (const vector<unsigned char> &band : bands)
+        writeUint32(&out, band.size());
+    for (const vector<unsigned char> &band : bands)
+        out.insert(out.end(), band.begin(), band.end());
+    return out;
+}
+
+bool decodeDistanceField(const unsigned char *data, size_t size, vector<unsigned char> *texels,
+                         int *width, int *height, int numThreads)
+{
+    if (size < 16 || memcmp(data, magic, 4) != 0)
+        return false;
+
+    uint32_t fieldWidth = readUint32(data + 4);
+    uint32_t fieldHeight = readUint32(data + 8);
+    uint32_t bandRows = readUint32(data + 12);
+    // The bands are as large as the encoder makes them, so that the table of
+    // their sizes bounds the number of texels a broken header can ask for
+    if (fieldWidth == 0 || fieldHeight == 0 || fieldWidth > uint32_t(INT_MAX)
+            || fieldHeight > uint32_t(INT_MAX) || bandRows != uint32_t(max(1, bandTexels / int(fieldWidth))))
+        return false;
+
+    size_t bandCount = (fieldHeight + bandRows - 1) / bandRows;
+    if (16 + bandCount * 4 > size)
+        return false;
+    vector<size_t> offsets(bandCount + 1, 16 + bandCount * 4);
+    for (size_t band = 0; band < bandCount; band++)
+        offsets[band + 1] = offsets[band] + readUint32(data + 16 + band * 4);
+    if (offsets[bandCount] > size)
+        return false;
+
+    texels->assign(size_t(fieldWidth) * fieldHeight, 0);
+    atomic<int> nextBand(0);
+    atomic<bool> ok(true);
+    runThreads(numThreads, [&](int) {
+        for (int band = nextBand++; band < int(bandCount); band = nextBand++) {
+            if (!decodeBand(data + offsets[band], offsets[band + 1] - offsets[band], texels->data(),
+                            fieldWidth, band * bandRows, min(fieldHeight, (band + 1) * bandRows)))
+                ok = false;
+        }
+    });
+
+    *width = fieldWidth;
+    *height = fieldHeight;
+    return ok;
+}
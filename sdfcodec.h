@@ -0,0 +1,52 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SDFCODEC_H
+#define SDFCODEC_H
+
+#include <stddef.h>
+#include <vector>
+
+// Lossless codec for 8-bit distance fields. Distance fields are close to a
+// plane in most places as the distance grows at the same rate everywhere,
+// so each texel is predicted from the plane through its left, upper and
+// upper left neighbours, falling back to the nearer of the left and upper
+// neighbour across the creases of the medial axis. The residuals are coded
+// with rANS using frequencies adapted to four levels of local activity, in
+// bands of rows which are coded and decoded on separate threads.
+//
+// The codec doesn't depend on Qt, so this file and sdfcodec.cpp can be
+// dropped into a runtime as the decoder.
+
+// Encodes width x height texels with bytesPerLine bytes between the rows
+std::vector<unsigned char> encodeDistanceField(const unsigned char *texels, int width, int height,
+                                               int bytesPerLine, int numThreads);
+
+// Decodes a field into texels, which get width x height bytes without any
+// padding between the rows. Returns false if the data is broken.
+bool decodeDistanceField(const unsigned char *data, size_t size, std::vector<unsigned char> *texels,
+                         int *width, int *height, int numThreads);
+
+#endif // SDFCODEC_H
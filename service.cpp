@@ -0,0 +1,463 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "service.h"
+#include "batch.h"
+#include "fieldio.h"
+#include "messages.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QImage>
+#include <QVector>
+#include <thread>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/types.h>
+// Running bakes can be stopped and continued to make room for more urgent ones
+static const bool canSuspend = true;
+#else
+static const bool canSuspend = false;
+#endif
+
+using namespace std;
+
+// Service protocol messages
+enum ServiceMessageType : quint8
+{
+    SubmitMessage,      // client: input, output, bake arguments, priority, columns, rows
+    FinishedMessage,    // service: success, log
+    CancelledMessage    // service: reason
+};
+
+// Options clients may pass on to the bakes, none of which write files
+static const QStringList flagOptions = { "negate" };
+static const QStringList valueOptions = {
+    "sourcesize", "maxerror", "maxdist", "targetsize", "maxdisplayerror", "threads", "t", "rasterizer",
+    "parser", "algorithm", "search", "quality", "gradientbits", "progressive", "tiles", "sparse"
+};
+// Options naming a file the bake writes, which has to lie within the output root
+static const QStringList fileOptions = { "gradient", "savesource" };
+
+BakeService::BakeService(const QString &outputRoot) :
+    m_outputRoot(QFileInfo(outputRoot).canonicalFilePath()),
+    m_nextSequence(0)
+{
+    QObject::connect(&m_server, &QTcpServer::newConnection, [this]() { acceptConnection(); });
+}
+
+BakeService::~BakeService()
+{
+    for (const UnitPointer &unit : m_units) {
+        if (unit->process) {
+            unit->process->disconnect();
+            unit->process->kill();
+            unit->process->waitForFinished();
+            delete unit->process;
+        }
+    }
+}
+
+bool BakeService::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_server.listen(address, port)) {
+        qWarning("Failed to listen on %s:%d: %s", qPrintable(address.toString()), port,
+                 qPrintable(m_server.errorString()));
+        return false;
+    }
+    qInfo("Waiting for bake requests on %s:%d, writing into %s", qPrintable(address.toString()),
+          m_server.serverPort(), qPrintable(m_outputRoot));
+    return true;
+}
+
+void BakeService::acceptConnection()
+{
+    while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+        QObject::connect(socket, &QTcpSocket::readyRead, [this, socket]() { readMessages(socket); });
+        QObject::connect(socket, &QTcpSocket::disconnected, [this, socket]() {
+            // Nobody is waiting for the result anymore
+            shared_ptr<Request> request = m_requests.take(socket);
+            if (request) {
+                qInfo("Dropped %s as the client went away", qPrintable(request->output));
+                request->done = true;
+                dropUnits(request);
+                schedule();
+            }
+            socket->deleteLater();
+        });
+    }
+}
+
+void BakeService::readMessages(QTcpSocket *socket)
+{
+    receiveMessages(socket, [&](QDataStream &message) {
+        quint8 type;
+        message >> type;
+        if (type != SubmitMessage || m_requests.contains(socket))
+            return;
+
+        shared_ptr<Request> request = make_shared<Request>();
+        qint32 priority, columns, rows;
+        message >> request->input >> request->output >> request->arguments >> priority >> columns >> rows;
+        request->client = socket;
+        request->priority = priority;
+        request->columns = qMax(1, int(columns));
+        request->rows = qMax(1, int(rows));
+        submit(request);
+    });
+}
+
+bool BakeService::checkRequest(Request *request, QString *reason) const
+{
+    if (!isWithinRoot(request->output)) {
+        *reason = request->output + " is outside of the output root";
+        return false;
+    }
+
+    bool sharded = request->columns * request->rows > 1;
+    QStringList arguments;
+    const QStringList &given = request->arguments;
+    for (int i = 0; i < given.count(); i++) {
+        const QString &option = given.at(i);
+        QString name = option.startsWith("--") ? option.mid(2)
+                                               : option.startsWith("-") ? option.mid(1) : QString();
+        if (flagOptions.contains(name)) {
+            arguments << option;
+            continue;
+        }
+        if (!valueOptions.contains(name) && !fileOptions.contains(name)) {
+            *reason = option + " isn't allowed in requests";
+            return false;
+        }
+        if (i + 1 == given.count()) {
+            *reason = option + " is missing its value";
+            return false;
+        }
+
+        QString value = given.at(++i);
+        if (fileOptions.contains(name)) {
+            // Every shard would write the same file
+            if (sharded) {
+                *reason = option + " isn't available with shards";
+                return false;
+            }
+            if (!isWithinRoot(value)) {
+                *reason = value + " is outside of the output root";
+                return false;
+            }
+        }
+
+        // The workers turn these down with --shard
+        if (sharded && (name == "progressive" || (name == "targetsize" && value == "auto"))) {
+            *reason = option + " " + value + " isn't available with shards";
+            return false;
+        }
+
+        // The shards are baked as plain fields and the service writes the
+        // joined one as asked
+        if (sharded && (name == "tiles" || name == "sparse")) {
+            int size = value.toInt();
+            if (size < 1) {
+                *reason = option + " needs a positive size";
+                return false;
+            }
+            if (name == "tiles")
+                request->tileSize = size;
+            else
+                request->sparseTileSize = size;
+            continue;
+        }
+        arguments << option << value;
+    }
+    request->arguments = arguments;
+    return true;
+}
+
+bool BakeService::isWithinRoot(const QString &path) const
+{
+    // Links could lead out of the root, and dots would name a directory
+    QFileInfo info(path);
+    if (info.isSymLink() || info.fileName().isEmpty() || info.fileName() == "." || info.fileName() == "..")
+        return false;
+    QString directory = QFileInfo(info.absolutePath()).canonicalFilePath();
+    if (directory.isEmpty() || m_outputRoot.isEmpty())
+        return false;
+    return directory == m_outputRoot || directory.startsWith(m_outputRoot.endsWith("/") ? m_outputRoot
+                                                                                        : m_outputRoot + "/");
+}
+
+void BakeService::submit(const shared_ptr<Request> &request)
+{
+    QString reason;
+    if (!checkRequest(request.get(), &reason)) {
+        cancel(request, reason);
+        return;
+    }
+
+    for (const shared_ptr<Request> &other : m_requests.values()) {
+        if (other->output == request->output)
+            cancel(other, "superseded by a newer request");
+    }
+
+    request->sequence = m_nextSequence++;
+    m_requests.insert(request->client, request);
+    if (request->columns * request->rows > 1) {
+        request->shardDir.reset(new QTemporaryDir);
+        if (!request->shardDir->isValid()) {
+            finishRequest(request, false, "failed to create a directory for the shards");
+            return;
+        }
+    }
+
+    for (int row = 0; row < request->rows; row++) {
+        for (int column = 0; column < request->columns; column++) {
+            UnitPointer unit = make_shared<Unit>();
+            unit->request = request;
+            unit->column = column;
+            unit->row = row;
+            m_units.append(unit);
+            request->unfinishedUnits++;
+        }
+    }
+    qInfo("Queued %s with priority %d", qPrintable(request->output), request->priority);
+    schedule();
+}
+
+void BakeService::cancel(const shared_ptr<Request> &request, const QString &reason)
+{
+    qInfo("Cancelled %s: %s", qPrintable(request->output), qPrintable(reason));
+    request->done = true;
+    dropUnits(request);
+    m_requests.remove(request->client);
+
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(CancelledMessage) << reason;
+    sendMessage(request->client, message);
+}
+
+void BakeService::dropUnits(const shared_ptr<Request> &request)
+{
+    for (const UnitPointer &unit : QList<UnitPointer>(m_units)) {
+        if (unit->request != request)
+            continue;
+        // Running units are removed once their process has exited
+        if (unit->process)
+            unit->process->kill();
+        else
+            m_units.removeAll(unit);
+    }
+}
+
+void BakeService::unitFinished(const UnitPointer &unit)
+{
+    m_units.removeAll(unit);
+    QProcess *process = unit->process;
+    unit->process = nullptr;
+    process->deleteLater();
+
+    shared_ptr<Request> request = unit->request;
+    if (!request->done) {
+        QString log = QString::fromLocal8Bit(process->readAll()).trimmed();
+        // distbake prints the help and exits normally on bad arguments, so
+        // look for the output file as well
+        bool success = process->exitStatus() == QProcess::NormalExit && process->exitCode() == 0
+                && QFileInfo(unitOutput(*unit)).exists();
+        if (!success)
+            finishRequest(request, false, log.isEmpty() ? "failed to run distbake" : log);
+        else if (--request->unfinishedUnits == 0)
+            finishRequest(request, true, log);
+    }
+    schedule();
+}
+
+void BakeService::finishRequest(const shared_ptr<Request> &request, bool success, QString log)
+{
+    request->done = true;
+    dropUnits(request);
+    m_requests.remove(request->client);
+
+    if (success && request->shardDir) {
+        QVector<QImage> shards;
+        for (int row = 0; row < request->rows; row++) {
+            for (int column = 0; column < request->columns; column++)
+                shards.append(QImage(request->shardDir->filePath(QString("%1_%2.png").arg(column).arg(row))));
+        }
+        QImage field = joinShards(shards, request->columns, request->rows);
+        int numThreads = qMax(1, int(thread::hardware_concurrency()));
+        if (field.isNull() || !writeField(field, request->output, request->tileSize,
+                                          request->sparseTileSize, numThreads)) {
+            success = false;
+            log = "failed to join the shards into " + request->output;
+        }
+        request->shardDir.reset();
+    }
+    qInfo("%s %s", success ? "Baked" : "Failed to bake", qPrintable(request->output));
+
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(FinishedMessage) << success << log;
+    sendMessage(request->client, message);
+}
+
+void BakeService::schedule()
+{
+    // Whether request a should be baked before request b
+    auto precedes = [](const shared_ptr<Request> &a, const shared_ptr<Request> &b) {
+        return a->priority > b->priority || (a->priority == b->priority && a->sequence < b->sequence);
+    };
+
+    // Only one bake is active at a time, as each one uses all the cores
+    while (true) {
+        UnitPointer waiting, active;
+        for (const UnitPointer &unit : m_units) {
+            if (unit->state == Unit::Running)
+                active = unit;
+            else if (!unit->request->done && (!waiting || precedes(unit->request, waiting->request)))
+                waiting = unit;
+        }
+        if (!waiting)
+            return;
+        if (active) {
+            if (!canSuspend || active->request->done
+                    || waiting->request->priority <= active->request->priority) {
+                return;
+            }
+            suspend(active);
+        }
+        run(waiting);
+    }
+}
+
+void BakeService::run(const UnitPointer &unit)
+{
+    if (unit->state == Unit::Suspended) {
+#ifdef Q_OS_UNIX
+        ::kill(unit->process->processId(), SIGCONT);
+#endif
+        unit->state = Unit::Running;
+        return;
+    }
+
+    const Request &request = *unit->request;
+    QStringList arguments = request.arguments;
+    if (request.shardDir) {
+        arguments << "--shard" << QString("%1,%2,%3,%4").arg(unit->column).arg(unit->row)
+                     .arg(request.columns).arg(request.rows);
+    }
+    arguments << request.input << unitOutput(*unit);
+
+    unit->state = Unit::Running;
+    unit->process = new QProcess;
+    unit->process->setProcessChannelMode(QProcess::MergedChannels);
+    QObject::connect(unit->process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                     [this, unit](int, QProcess::ExitStatus) { unitFinished(unit); });
+    unit->process->start(QCoreApplication::applicationFilePath(), arguments);
+}
+
+void BakeService::suspend(const UnitPointer &unit)
+{
+#ifdef Q_OS_UNIX
+    ::kill(unit->process->processId(), SIGSTOP);
+#endif
+    unit->state = Unit::Suspended;
+}
+
+QString BakeService::unitOutput(const Unit &unit) const
+{
+    if (!unit.request->shardDir)
+        return unit.request->output;
+    return unit.request->shardDir->filePath(QString("%1_%2.png").arg(unit.column).arg(unit.row));
+}
+
+ServiceClient::ServiceClient()
+{
+    QObject::connect(&m_socket, &QTcpSocket::readyRead, [this]() { readMessages(); });
+    QObject::connect(&m_socket, &QTcpSocket::disconnected, []() {
+        qWarning("The service hung up before finishing the bake");
+        QCoreApplication::exit(1);
+    });
+    QObject::connect(&m_socket, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error),
+                     [this](QAbstractSocket::SocketError) {
+        if (m_socket.state() != QAbstractSocket::ConnectedState) {
+            qWarning("Failed to reach the service: %s", qPrintable(m_socket.errorString()));
+            QCoreApplication::exit(1);
+        }
+    });
+}
+
+void ServiceClient::submit(const QString &host, quint16 port, const QString &input, const QString &output,
+                           const QStringList &arguments, int priority, int columns, int rows)
+{
+    // The service resolves the files relative to its own directory
+    QStringList absoluteArguments = arguments;
+    for (int i = 0; i + 1 < absoluteArguments.count(); i++) {
+        const QString &option = absoluteArguments.at(i);
+        if (option.startsWith("--") && fileOptions.contains(option.mid(2))) {
+            absoluteArguments[i + 1] = QFileInfo(absoluteArguments.at(i + 1)).absoluteFilePath();
+            i++;
+        }
+    }
+
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(SubmitMessage) << QFileInfo(input).absoluteFilePath()
+           << QFileInfo(output).absoluteFilePath() << absoluteArguments
+           << qint32(priority) << qint32(columns) << qint32(rows);
+
+    QObject::connect(&m_socket, &QTcpSocket::connected, [this, message]() {
+        sendMessage(&m_socket, message);
+    });
+    m_socket.connectToHost(host, port);
+}
+
+void ServiceClient::readMessages()
+{
+    receiveMessages(&m_socket, [&](QDataStream &message) {
+        quint8 type;
+        message >> type;
+        if (type == FinishedMessage) {
+            bool success;
+            QString log;
+            message >> success >> log;
+            if (!log.isEmpty())
+                qInfo("%s", qPrintable(log));
+            m_socket.disconnect();
+            QCoreApplication::exit(success ? 0 : 1);
+        } else if (type == CancelledMessage) {
+            QString reason;
+            message >> reason;
+            qWarning("The bake was cancelled: %s", qPrintable(reason));
+            m_socket.disconnect();
+            QCoreApplication::exit(1);
+        }
+    });
+}
@@ -0,0 +1,128 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QProcess>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <memory>
+
+// Resident bake service for interactive tools. Clients connect over TCP and
+// submit one request each, which is baked by a child distbake process. Large
+// bakes can be split into shards baked one after another, so the service
+// gets to pick the next piece of work between them. Higher priority requests
+// go first, and on Unix a running bake of a lower priority is suspended while
+// a higher priority one is waiting. A new request for the same output file
+// cancels the earlier one, as does the client hanging up. Clients aren't
+// authenticated, so they may only pass on the bake options that can't write
+// files, and outputs have to lie within the output root.
+class BakeService
+{
+public:
+    explicit BakeService(const QString &outputRoot);
+    ~BakeService();
+
+    bool listen(const QHostAddress &address, quint16 port);
+
+private:
+    struct Request
+    {
+        QTcpSocket *client = nullptr;
+        QString input;
+        QString output;
+        QStringList arguments;
+        int priority = 0;
+        int columns = 1;
+        int rows = 1;
+        // Output options the service applies to the joined shards
+        int tileSize = 0;
+        int sparseTileSize = 0;
+        qint64 sequence = 0;
+        int unfinishedUnits = 0;
+        // Set once the request has been answered, after which its units are dropped
+        bool done = false;
+        std::unique_ptr<QTemporaryDir> shardDir;
+    };
+
+    // A shard of a request, or the whole of it if it isn't sharded
+    struct Unit
+    {
+        enum State { Queued, Running, Suspended };
+
+        std::shared_ptr<Request> request;
+        int column = 0;
+        int row = 0;
+        State state = Queued;
+        QProcess *process = nullptr;
+    };
+    typedef std::shared_ptr<Unit> UnitPointer;
+
+    void acceptConnection();
+    void readMessages(QTcpSocket *socket);
+    bool checkRequest(Request *request, QString *reason) const;
+    bool isWithinRoot(const QString &path) const;
+    void submit(const std::shared_ptr<Request> &request);
+    void cancel(const std::shared_ptr<Request> &request, const QString &reason);
+    void dropUnits(const std::shared_ptr<Request> &request);
+    void unitFinished(const UnitPointer &unit);
+    void finishRequest(const std::shared_ptr<Request> &request, bool success, QString log);
+    void schedule();
+    void run(const UnitPointer &unit);
+    void suspend(const UnitPointer &unit);
+    QString unitOutput(const Unit &unit) const;
+
+    QString m_outputRoot;
+    QTcpServer m_server;
+    QHash<QTcpSocket *, std::shared_ptr<Request>> m_requests;
+    QList<UnitPointer> m_units;
+    qint64 m_nextSequence;
+};
+
+// Submits a request to a bake service and waits for its result. The
+// application exits with 0 once the output has been written.
+class ServiceClient
+{
+public:
+    ServiceClient();
+
+    // input and output are made absolute, as the service may run in another
+    // working directory
+    void submit(const QString &host, quint16 port, const QString &input, const QString &output,
+                const QStringList &arguments, int priority, int columns, int rows);
+
+private:
+    void readMessages();
+
+    QTcpSocket m_socket;
+};
+
+#endif // SERVICE_H
@@ -0,0 +1,67 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shape.h"
+
+#include <math.h>
+
+QVector<Shape> mapShapes(const QVector<Shape> &shapes, const QTransform &transform)
+{
+    QVector<Shape> mapped;
+    mapped.reserve(shapes.count());
+    for (const Shape &shape : shapes) {
+        Shape mappedShape;
+        for (const QPolygonF &polygon : shape.polygons)
+            mappedShape.polygons.append(transform.map(polygon));
+        mappedShape.bounds = transform.mapRect(shape.bounds);
+        mappedShape.fillRule = shape.fillRule;
+        mappedShape.color = shape.color;
+        mappedShape.opacity = shape.opacity;
+        mappedShape.layer = shape.layer;
+        mapped.append(mappedShape);
+    }
+    return mapped;
+}
+
+void setStrokeGeometry(Shape *shape, const QPainterPath &path, const QTransform &transform,
+                       qreal width, Qt::PenCapStyle capStyle, Qt::PenJoinStyle joinStyle,
+                       qreal miterLimit)
+{
+    if (!transform.isAffine())
+        return;
+
+    // Both axes must be scaled by the same amount and stay perpendicular
+    qreal xScale = transform.m11() * transform.m11() + transform.m12() * transform.m12();
+    qreal yScale = transform.m21() * transform.m21() + transform.m22() * transform.m22();
+    qreal skew = transform.m11() * transform.m21() + transform.m12() * transform.m22();
+    if (fabs(xScale - yScale) > 1e-6 * xScale || fabs(skew) > 1e-6 * xScale)
+        return;
+
+    shape->stroke.centerline = transform.map(path);
+    shape->stroke.width = width * sqrt(xScale);
+    shape->stroke.capStyle = capStyle;
+    shape->stroke.joinStyle = joinStyle;
+    shape->stroke.miterLimit = miterLimit;
+}
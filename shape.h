@@ -0,0 +1,86 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <QPainterPath>
+#include <QPolygonF>
+#include <QRectF>
+#include <QVector>
+#include <QColor>
+#include <QTransform>
+#include <QString>
+
+// Centerline geometry of a stroke in device coordinates. A zero width means
+// that the shape isn't a stroke or that its outline can't be reproduced by
+// offsetting the centerline (dashes, non-uniform scaling).
+struct StrokeGeometry
+{
+    QPainterPath centerline;
+    qreal width = 0.0;
+    Qt::PenCapStyle capStyle = Qt::FlatCap;
+    Qt::PenJoinStyle joinStyle = Qt::SvgMiterJoin;
+    qreal miterLimit = 4.0;
+};
+
+// A single filled area of the input in source buffer (device) coordinates.
+// Curves are already flattened and strokes already converted to outlines.
+struct Shape
+{
+    QVector<QPolygonF> polygons;
+    QRectF bounds;
+    Qt::FillRule fillRule = Qt::OddEvenFill;
+    QRgb color = qRgb(0, 0, 0);
+    float opacity = 1.0f;
+    StrokeGeometry stroke;
+    // Id of the top level element of the document the shape belongs to, if known
+    QString layer;
+};
+
+// Flattens a path given in device coordinates into a Shape
+inline Shape shapeFromPath(const QPainterPath &devicePath, QRgb color, float opacity)
+{
+    Shape shape;
+    shape.polygons = devicePath.toSubpathPolygons().toVector();
+    shape.bounds = devicePath.controlPointRect();
+    shape.fillRule = devicePath.fillRule();
+    shape.color = color;
+    shape.opacity = opacity;
+    return shape;
+}
+
+// Maps the polygons and bounds of the shapes, e.g. to rasterize them at
+// another resolution. The stroke geometry is left out.
+QVector<Shape> mapShapes(const QVector<Shape> &shapes, const QTransform &transform);
+
+// Stores the centerline of an undashed stroke of the given width drawn along
+// path under transform. Nothing is stored unless transform scales uniformly,
+// as the stroke outline isn't an offset of the mapped centerline otherwise.
+void setStrokeGeometry(Shape *shape, const QPainterPath &path, const QTransform &transform,
+                       qreal width, Qt::PenCapStyle capStyle, Qt::PenJoinStyle joinStyle,
+                       qreal miterLimit);
+
+#endif // SHAPE_H
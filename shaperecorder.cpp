@@ -0,0 +1,215 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shaperecorder.h"
+
+#include <QPaintEngine>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPainterPathStroker>
+#include <QPen>
+#include <QBrush>
+#include <QTransform>
+
+class ShapeRecordingEngine : public QPaintEngine
+{
+public:
+    explicit ShapeRecordingEngine(ShapeRecorder *recorder);
+
+    bool begin(QPaintDevice *) override { return true; }
+    bool end() override { return true; }
+    Type type() const override { return User; }
+
+    void updateState(const QPaintEngineState &state) override;
+
+    void drawPath(const QPainterPath &path) override;
+    void drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode) override;
+    void drawPixmap(const QRectF &r, const QPixmap &pm, const QRectF &sr) override;
+    void drawImage(const QRectF &r, const QImage &pm, const QRectF &sr,
+                   Qt::ImageConversionFlags flags) override;
+
+private:
+    void record(const QPainterPath &path, bool fill);
+    Shape *addShape(const QPainterPath &devicePath, const QBrush &brush);
+
+    ShapeRecorder *m_recorder;
+    QTransform m_transform;
+    QBrush m_brush;
+    QPen m_pen;
+    qreal m_opacity;
+    bool m_clipEnabled;
+    bool m_hasClip;
+    QPainter::CompositionMode m_compositionMode;
+};
+
+ShapeRecordingEngine::ShapeRecordingEngine(ShapeRecorder *recorder) :
+    QPaintEngine(AllFeatures),
+    m_recorder(recorder),
+    m_opacity(1.0),
+    m_clipEnabled(true),
+    m_hasClip(false),
+    m_compositionMode(QPainter::CompositionMode_SourceOver)
+{
+}
+
+void ShapeRecordingEngine::updateState(const QPaintEngineState &state)
+{
+    DirtyFlags flags = state.state();
+    if (flags & DirtyTransform)
+        m_transform = state.transform();
+    if (flags & DirtyBrush)
+        m_brush = state.brush();
+    if (flags & DirtyPen)
+        m_pen = state.pen();
+    if (flags & DirtyOpacity)
+        m_opacity = state.opacity();
+    if (flags & DirtyCompositionMode)
+        m_compositionMode = state.compositionMode();
+    if (flags & DirtyClipEnabled)
+        m_clipEnabled = state.isClipEnabled();
+    if (flags & (DirtyClipPath | DirtyClipRegion))
+        m_hasClip = state.clipOperation() != Qt::NoClip;
+}
+
+void ShapeRecordingEngine::drawPath(const QPainterPath &path)
+{
+    record(path, true);
+}
+
+void ShapeRecordingEngine::drawPolygon(const QPointF *points, int pointCount, PolygonDrawMode mode)
+{
+    QPainterPath path;
+    path.addPolygon(QPolygonF(QVector<QPointF>(points, points + pointCount)));
+    if (mode != PolylineMode)
+        path.closeSubpath();
+    path.setFillRule(mode == OddEvenMode ? Qt::OddEvenFill : Qt::WindingFill);
+    record(path, mode != PolylineMode);
+}
+
+void ShapeRecordingEngine::drawPixmap(const QRectF &, const QPixmap &, const QRectF &)
+{
+    m_recorder->m_complete = false;
+}
+
+void ShapeRecordingEngine::drawImage(const QRectF &, const QImage &, const QRectF &,
+                                     Qt::ImageConversionFlags)
+{
+    m_recorder->m_complete = false;
+}
+
+void ShapeRecordingEngine::record(const QPainterPath &path, bool fill)
+{
+    if ((m_clipEnabled && m_hasClip) || m_compositionMode != QPainter::CompositionMode_SourceOver) {
+        m_recorder->m_complete = false;
+        return;
+    }
+
+    if (fill)
+        addShape(m_transform.map(path), m_brush);
+
+    if (m_pen.style() != Qt::NoPen) {
+        QPainterPathStroker stroker(m_pen);
+        Shape *shape;
+        if (m_pen.isCosmetic()) {
+            // Cosmetic pens are measured in device pixels and zero means one pixel
+            stroker.setWidth(qMax<qreal>(m_pen.widthF(), 1.0));
+            shape = addShape(stroker.createStroke(m_transform.map(path)), m_pen.brush());
+        } else {
+            shape = addShape(m_transform.map(stroker.createStroke(path)), m_pen.brush());
+        }
+
+        if (shape && m_pen.style() == Qt::SolidLine) {
+            if (m_pen.isCosmetic())
+                setStrokeGeometry(shape, m_transform.map(path), QTransform(), stroker.width(),
+                                  m_pen.capStyle(), m_pen.joinStyle(), m_pen.miterLimit());
+            else
+                setStrokeGeometry(shape, path, m_transform, stroker.width(),
+                                  m_pen.capStyle(), m_pen.joinStyle(), m_pen.miterLimit());
+        }
+    }
+}
+
+Shape *ShapeRecordingEngine::addShape(const QPainterPath &devicePath, const QBrush &brush)
+{
+    if (brush.style() == Qt::NoBrush)
+        return nullptr;
+
+    if (brush.style() != Qt::SolidPattern) {
+        m_recorder->m_complete = false;
+        return nullptr;
+    }
+
+    float opacity = m_opacity * brush.color().alphaF();
+    if (opacity <= 0.0f || devicePath.isEmpty())
+        return nullptr;
+
+    m_recorder->m_shapes.append(shapeFromPath(devicePath, brush.color().rgb(), opacity));
+    return &m_recorder->m_shapes.last();
+}
+
+ShapeRecorder::ShapeRecorder(const QSize &size) :
+    m_size(size),
+    m_complete(true),
+    m_engine(new ShapeRecordingEngine(this))
+{
+}
+
+ShapeRecorder::~ShapeRecorder()
+{
+}
+
+QPaintEngine *ShapeRecorder::paintEngine() const
+{
+    return m_engine.get();
+}
+
+int ShapeRecorder::metric(PaintDeviceMetric metric) const
+{
+    // Pretend to be a 96 dpi image so that unit conversions match QImage
+    switch (metric) {
+    case PdmWidth:
+        return m_size.width();
+    case PdmHeight:
+        return m_size.height();
+    case PdmWidthMM:
+        return qRound(m_size.width() * 25.4 / 96);
+    case PdmHeightMM:
+        return qRound(m_size.height() * 25.4 / 96);
+    case PdmNumColors:
+        return 256;
+    case PdmDepth:
+        return 32;
+    case PdmDpiX:
+    case PdmDpiY:
+    case PdmPhysicalDpiX:
+    case PdmPhysicalDpiY:
+        return 96;
+    case PdmDevicePixelRatio:
+        return 1;
+    case PdmDevicePixelRatioScaled:
+        return devicePixelRatioFScale();
+    }
+    return QPaintDevice::metric(metric);
+}
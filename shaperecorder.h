@@ -0,0 +1,65 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SHAPERECORDER_H
+#define SHAPERECORDER_H
+
+#include "shape.h"
+
+#include <QPaintDevice>
+#include <QSize>
+#include <memory>
+
+class ShapeRecordingEngine;
+
+// A paint device which turns everything painted on it into Shapes instead of
+// pixels. QSvgRenderer can render into it like into any other paint device.
+// If something gets painted which can't be expressed as solid colored shapes
+// (images, gradients, clipping, ...) the recording is marked incomplete and
+// the caller should render the input with QPainter instead.
+class ShapeRecorder : public QPaintDevice
+{
+public:
+    explicit ShapeRecorder(const QSize &size);
+    ~ShapeRecorder();
+
+    QPaintEngine *paintEngine() const override;
+
+    const QVector<Shape> &shapes() const { return m_shapes; }
+    bool isComplete() const { return m_complete; }
+
+protected:
+    int metric(PaintDeviceMetric metric) const override;
+
+private:
+    friend class ShapeRecordingEngine;
+
+    QSize m_size;
+    QVector<Shape> m_shapes;
+    bool m_complete;
+    std::unique_ptr<ShapeRecordingEngine> m_engine;
+};
+
+#endif // SHAPERECORDER_H
@@ -0,0 +1,175 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sparse.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <math.h>
+
+SparseField::SparseField() :
+    m_tileSize(0),
+    m_columns(0),
+    m_rows(0)
+{
+}
+
+SparseField::SparseField(const QSize &size, int tileSize) :
+    m_size(size),
+    m_tileSize(tileSize),
+    m_columns((size.width() + tileSize - 1) / tileSize),
+    m_rows((size.height() + tileSize - 1) / tileSize),
+    m_tiles(m_columns * m_rows),
+    m_values(m_columns * m_rows, -1)
+{
+}
+
+SparseField SparseField::fromImage(const QImage &field, int tileSize)
+{
+    SparseField sparse(field.size(), tileSize);
+    for (int tile = 0; tile < sparse.tileCount(); tile++) {
+        QRect rect = sparse.tileRect(tile);
+        int value = field.constScanLine(rect.top())[rect.left()];
+        for (int y = rect.top(); y <= rect.bottom() && value >= 0; y++) {
+            const uchar *line = field.constScanLine(y);
+            for (int x = rect.left(); x <= rect.right(); x++) {
+                if (line[x] != value) {
+                    value = -1;
+                    break;
+                }
+            }
+        }
+
+        if (value >= 0)
+            sparse.setUniform(tile, value);
+        else
+            sparse.setTile(tile, field.copy(rect));
+    }
+    return sparse;
+}
+
+bool SparseField::isNull() const
+{
+    return m_tileSize == 0;
+}
+
+int SparseField::tileCount() const
+{
+    return m_columns * m_rows;
+}
+
+int SparseField::storedTileCount() const
+{
+    int count = 0;
+    for (int value : m_values)
+        count += value < 0 ? 1 : 0;
+    return count;
+}
+
+QRect SparseField::tileRect(int tile) const
+{
+    QRect rect((tile % m_columns) * m_tileSize, (tile / m_columns) * m_tileSize, m_tileSize, m_tileSize);
+    return rect & QRect(QPoint(0, 0), m_size);
+}
+
+void SparseField::setTile(int tile, const QImage &field)
+{
+    m_tiles[tile] = field;
+    m_values[tile] = -1;
+}
+
+void SparseField::setUniform(int tile, uchar value)
+{
+    m_tiles[tile] = QImage();
+    m_values[tile] = value;
+}
+
+bool SparseField::save(const QString &filename) const
+{
+    // Pack the stored tiles into a roughly square grid of slots. Partial tiles
+    // at the edges are padded by repeating their last texels.
+    int stored = storedTileCount();
+    int slotColumns = qMax(1, int(ceil(sqrt(double(stored)))));
+    int slotRows = qMax(1, (stored + slotColumns - 1) / slotColumns);
+    QImage atlas(slotColumns * m_tileSize, slotRows * m_tileSize, QImage::Format_Grayscale8);
+    atlas.fill(Qt::black);
+
+    QJsonArray slotTable, values;
+    int slot = 0;
+    for (int row = 0; row < m_rows; row++) {
+        QJsonArray rowSlots, rowValues;
+        for (int column = 0; column < m_columns; column++) {
+            int tile = row * m_columns + column;
+            rowValues.append(m_values.at(tile));
+            if (m_values.at(tile) >= 0) {
+                rowSlots.append(-1);
+                continue;
+            }
+
+            const QImage &field = m_tiles.at(tile);
+            int left = (slot % slotColumns) * m_tileSize;
+            int top = (slot / slotColumns) * m_tileSize;
+            for (int y = 0; y < m_tileSize; y++) {
+                const uchar *fieldLine = field.constScanLine(qMin(y, field.height() - 1));
+                uchar *atlasLine = atlas.scanLine(top + y) + left;
+                for (int x = 0; x < m_tileSize; x++)
+                    atlasLine[x] = fieldLine[qMin(x, field.width() - 1)];
+            }
+            rowSlots.append(slot++);
+        }
+        slotTable.append(rowSlots);
+        values.append(rowValues);
+    }
+
+    QJsonObject table;
+    table.insert("width", m_size.width());
+    table.insert("height", m_size.height());
+    table.insert("tileSize", m_tileSize);
+    table.insert("slotColumns", slotColumns);
+    table.insert("slots", slotTable);
+    table.insert("values", values);
+
+    QFileInfo output(filename);
+    QFile tableFile(output.path() + "/" + output.completeBaseName() + ".json");
+    return atlas.save(filename, "png") && tableFile.open(QIODevice::WriteOnly)
+            && tableFile.write(QJsonDocument(table).toJson()) > 0;
+}
+
+int uniformFieldValue(const QImage &source, const QRect &pixels, bool negate)
+{
+    // Pixels at or above mid-gray get negative distances, as in bruteForceDistanceField()
+    bool inside = source.constScanLine(pixels.top())[pixels.left()] >= 128;
+    for (int y = pixels.top(); y <= pixels.bottom(); y++) {
+        const uchar *line = source.constScanLine(y);
+        for (int x = pixels.left(); x <= pixels.right(); x++) {
+            if ((line[x] >= 128) != inside)
+                return -1;
+        }
+    }
+    return inside != negate ? 0 : 255;
+}
@@ -0,0 +1,77 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <vector>
+
+// Distance field split into square tiles of which only those near an edge
+// are stored. The others are saturated inside or outside of the shapes and
+// only keep their value.
+class SparseField
+{
+public:
+    SparseField();
+    SparseField(const QSize &size, int tileSize);
+
+    // Splits a field computed in one piece, storing the tiles which aren't uniform
+    static SparseField fromImage(const QImage &field, int tileSize);
+
+    bool isNull() const;
+    int tileCount() const;
+    int storedTileCount() const;
+
+    // Area of the tile in the field, cut off at the right and bottom edges
+    QRect tileRect(int tile) const;
+
+    // Different tiles can be set from different threads
+    void setTile(int tile, const QImage &field);
+    void setUniform(int tile, uchar value);
+
+    // Saves the stored tiles packed into the PNG file filename and the table
+    // mapping the tiles to them into a JSON file next to it. For every tile the
+    // table has the slot of the packed tiles it went into, or -1 and its value
+    // if it wasn't stored.
+    bool save(const QString &filename) const;
+
+private:
+    QSize m_size;
+    int m_tileSize;
+    int m_columns;
+    int m_rows;
+    std::vector<QImage> m_tiles;
+    std::vector<int> m_values;
+};
+
+// Returns the value the distance field has everywhere within reach of the
+// pixels of a Format_Grayscale8 source, if all of them are on the same side
+// of the mid-gray threshold, or -1 if not.
+int uniformFieldValue(const QImage &source, const QRect &pixels, bool negate);
+
+#endif // SPARSE_H
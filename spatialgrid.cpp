@@ -0,0 +1,73 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "spatialgrid.h"
+
+#include <math.h>
+
+SpatialGrid::SpatialGrid(const QRect &area, int cellSize) :
+    m_area(area),
+    m_cellSize(cellSize),
+    m_columns((area.width() + cellSize - 1) / cellSize),
+    m_rows((area.height() + cellSize - 1) / cellSize),
+    m_cells(m_columns * m_rows)
+{
+}
+
+void SpatialGrid::insert(int item, const QRectF &bounds)
+{
+    if (bounds.right() < m_area.left() || bounds.bottom() < m_area.top()
+            || bounds.left() > m_area.left() + m_area.width()
+            || bounds.top() > m_area.top() + m_area.height()) {
+        return;
+    }
+
+    int firstColumn = qMax(0, int(floor((bounds.left() - m_area.left()) / m_cellSize)));
+    int lastColumn = qMin(m_columns - 1, int(floor((bounds.right() - m_area.left()) / m_cellSize)));
+    int firstRow = qMax(0, int(floor((bounds.top() - m_area.top()) / m_cellSize)));
+    int lastRow = qMin(m_rows - 1, int(floor((bounds.bottom() - m_area.top()) / m_cellSize)));
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int column = firstColumn; column <= lastColumn; column++)
+            m_cells[row * m_columns + column].append(item);
+    }
+}
+
+QRect SpatialGrid::cellRect(int cell) const
+{
+    QRect rect(m_area.left() + (cell % m_columns) * m_cellSize,
+               m_area.top() + (cell / m_columns) * m_cellSize,
+               m_cellSize, m_cellSize);
+    return rect & m_area;
+}
+
+int SpatialGrid::cellAt(const QPointF &point) const
+{
+    int column = int(floor((point.x() - m_area.left()) / m_cellSize));
+    int row = int(floor((point.y() - m_area.top()) / m_cellSize));
+    if (column < 0 || row < 0 || column >= m_columns || row >= m_rows)
+        return -1;
+    return row * m_columns + column;
+}
@@ -0,0 +1,67 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <QRect>
+#include <QRectF>
+#include <QVector>
+
+// Buckets items into a uniform grid of square cells by their bounding boxes.
+// Work done on one cell (a tile of the output, a neighbourhood of a pixel)
+// then only needs to look at the items which can touch it instead of all of
+// them. Items are kept in insertion order within each cell, so inserting
+// shapes in painting order keeps them in painting order.
+class SpatialGrid
+{
+public:
+    SpatialGrid(const QRect &area, int cellSize);
+
+    void insert(int item, const QRectF &bounds);
+
+    const QRect &area() const { return m_area; }
+    int cellSize() const { return m_cellSize; }
+    int columns() const { return m_columns; }
+    int rows() const { return m_rows; }
+    int cellCount() const { return m_cells.count(); }
+
+    // The part of the area covered by the cell
+    QRect cellRect(int cell) const;
+
+    // Index of the cell containing point, or -1 if it's outside the area
+    int cellAt(const QPointF &point) const;
+
+    const QVector<int> &items(int cell) const { return m_cells.at(cell); }
+
+private:
+    QRect m_area;
+    int m_cellSize;
+    int m_columns;
+    int m_rows;
+    QVector<QVector<int> > m_cells;
+};
+
+#endif // SPATIALGRID_H
@@ -0,0 +1,93 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sprites.h"
+
+#include <QHash>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+QVector<Sprite> splitSprites(const QVector<Shape> &shapes, int margin)
+{
+    QVector<Sprite> sprites;
+    QHash<QString, int> spriteIndices;
+    QVector<QRectF> bounds;
+    for (const Shape &shape : shapes) {
+        if (shape.layer.isEmpty())
+            continue;
+
+        int index = spriteIndices.value(shape.layer, -1);
+        if (index < 0) {
+            index = sprites.count();
+            spriteIndices.insert(shape.layer, index);
+            sprites.append(Sprite());
+            sprites.last().id = shape.layer;
+            bounds.append(shape.bounds);
+        }
+        sprites[index].shapes.append(shape);
+        bounds[index] = bounds.at(index).united(shape.bounds);
+    }
+
+    for (int i = 0; i < sprites.count(); i++)
+        sprites[i].area = bounds.at(i).adjusted(-margin, -margin, margin, margin).toAlignedRect();
+    return sprites;
+}
+
+QSize packSprites(QVector<Sprite> *sprites, int spacing)
+{
+    // Shelf packing: the tallest sprites go first, and rows are filled up to
+    // a width which makes the sheet roughly square
+    QVector<int> order;
+    qint64 area = 0;
+    int widest = 0;
+    for (int i = 0; i < sprites->count(); i++) {
+        QSize size = sprites->at(i).field.size() + QSize(spacing, spacing);
+        area += qint64(size.width()) * size.height();
+        widest = qMax(widest, size.width());
+        order.append(i);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return sprites->at(a).field.height() > sprites->at(b).field.height();
+    });
+
+    int rowWidth = qMax(widest, int(ceil(sqrt(double(area)))));
+    QPoint position(0, 0);
+    int rowHeight = 0;
+    int sheetWidth = 0;
+    for (int index : order) {
+        Sprite &sprite = (*sprites)[index];
+        if (position.x() > 0 && position.x() + sprite.field.width() > rowWidth) {
+            position = QPoint(0, position.y() + rowHeight + spacing);
+            rowHeight = 0;
+        }
+        sprite.position = position;
+        sheetWidth = qMax(sheetWidth, position.x() + sprite.field.width());
+        rowHeight = qMax(rowHeight, sprite.field.height());
+        position.rx() += sprite.field.width() + spacing;
+    }
+    return QSize(sheetWidth, position.y() + rowHeight);
+}
@@ -0,0 +1,55 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include "shape.h"
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+// An element of a sprite sheet document along with the area of the source
+// buffer it covers and its distance field once baked
+struct Sprite
+{
+    QString id;
+    QRect area;
+    QVector<Shape> shapes;
+    QImage field;
+    QPoint position;
+};
+
+// Groups the shapes by the top level element of the document they belong to.
+// Shapes outside of elements with an id are dropped. Each sprite covers the
+// bounds of its shapes grown by margin pixels.
+QVector<Sprite> splitSprites(const QVector<Shape> &shapes, int margin);
+
+// Arranges the fields of the sprites into rows of a sheet with spacing pixels
+// between them, storing their positions. Returns the size of the sheet.
+QSize packSprites(QVector<Sprite> *sprites, int spacing);
+
+#endif // SPRITES_H
@@ -0,0 +1,393 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "strokedistance.h"
+#include "distancefield.h"
+#include "parallel.h"
+
+#include <math.h>
+
+using namespace std;
+
+// Maximum distance between a flattened curve and the real one in source pixels
+static const qreal flatness = 0.1;
+
+static const int gridCellSize = 32;
+
+static inline qreal dot(const QPointF &a, const QPointF &b)
+{
+    return a.x() * b.x() + a.y() * b.y();
+}
+
+static inline qreal cross(const QPointF &a, const QPointF &b)
+{
+    return a.x() * b.y() - a.y() * b.x();
+}
+
+static inline QPointF normalized(const QPointF &v)
+{
+    return v / sqrt(dot(v, v));
+}
+
+StrokeDistanceField::StrokeDistanceField(const QRect &area, float maxDist) :
+    m_maxDist(maxDist),
+    m_grid(area, gridCellSize)
+{
+}
+
+bool StrokeDistanceField::canRender(const QVector<Shape> &shapes, bool negate)
+{
+    int background = negate ? 0 : 255;
+    for (const Shape &shape : shapes) {
+        if (shape.stroke.width <= 0.0)
+            return false;
+
+        // The stroke must land on the inside of the mid-gray threshold on its own
+        float gray = background + (qGray(shape.color) - background) * shape.opacity;
+        if (negate ? gray < 128.0f : gray >= 128.0f)
+            return false;
+    }
+    return true;
+}
+
+void StrokeDistanceField::addStroke(const StrokeGeometry &stroke)
+{
+    // Vertices of the path itself get the join style of the stroke, the ones
+    // added by flattening curves are joined smoothly
+    const QPainterPath &path = stroke.centerline;
+    QPolygonF points;
+    QVector<bool> corners;
+
+    for (int i = 0; i < path.elementCount(); i++) {
+        QPainterPath::Element element = path.elementAt(i);
+        switch (element.type) {
+        case QPainterPath::MoveToElement:
+            addSubpath(points, corners, stroke);
+            points.clear();
+            corners.clear();
+            points << element;
+            corners << true;
+            break;
+        case QPainterPath::LineToElement:
+            points << element;
+            corners << true;
+            break;
+        case QPainterPath::CurveToElement: {
+            QPointF p0 = points.last();
+            QPointF p1 = element;
+            QPointF p2 = path.elementAt(i + 1);
+            QPointF p3 = path.elementAt(i + 2);
+            i += 2;
+
+            // The second differences bound how far the curve strays from its chords
+            QPointF d0 = p0 - 2 * p1 + p2;
+            QPointF d1 = p1 - 2 * p2 + p3;
+            qreal deviation = 0.75 * sqrt(qMax(dot(d0, d0), dot(d1, d1)));
+            int steps = qBound(1, int(ceil(sqrt(deviation / flatness))), 1000);
+            for (int step = 1; step <= steps; step++) {
+                qreal t = qreal(step) / steps;
+                qreal s = 1.0 - t;
+                points << s * s * s * p0 + 3 * s * s * t * p1 + 3 * s * t * t * p2 + t * t * t * p3;
+                corners << (step == steps);
+            }
+            break;
+        }
+        case QPainterPath::CurveToDataElement:
+            break;
+        }
+    }
+    addSubpath(points, corners, stroke);
+}
+
+void StrokeDistanceField::addSubpath(const QPolygonF &path, const QVector<bool> &pathCorners,
+                                     const StrokeGeometry &stroke)
+{
+    // A lone move doesn't draw anything
+    if (path.count() < 2)
+        return;
+
+    QPolygonF points;
+    QVector<bool> corners;
+    for (int i = 0; i < path.count(); i++) {
+        if (!points.isEmpty() && points.last() == path.at(i)) {
+            corners.last() = corners.last() || pathCorners.at(i);
+            continue;
+        }
+        points << path.at(i);
+        corners << pathCorners.at(i);
+    }
+
+    qreal halfWidth = stroke.width / 2;
+    if (points.count() == 1) {
+        // A zero length subpath only gets its caps drawn
+        if (stroke.capStyle == Qt::RoundCap) {
+            addDisc(points.first(), halfWidth);
+        } else if (stroke.capStyle == Qt::SquareCap) {
+            QPointF corner(halfWidth, halfWidth);
+            addPolygon(QPolygonF(QRectF(points.first() - corner, points.first() + corner)));
+        }
+        return;
+    }
+
+    // Subpaths ending where they started are joined instead of capped
+    bool closed = points.count() > 2 && points.first() == points.last();
+    if (closed) {
+        points.removeLast();
+        corners.first() = true;
+        corners.removeLast();
+    }
+
+    int count = points.count();
+    int segments = closed ? count : count - 1;
+    qreal capExtension = !closed && stroke.capStyle == Qt::SquareCap ? halfWidth : 0.0;
+    for (int i = 0; i < segments; i++) {
+        addSegment(points.at(i), points.at((i + 1) % count),
+                   i == 0 ? capExtension : 0.0,
+                   i == segments - 1 ? capExtension : 0.0, halfWidth);
+    }
+
+    if (!closed && stroke.capStyle == Qt::RoundCap) {
+        addDisc(points.first(), halfWidth);
+        addDisc(points.last(), halfWidth);
+    }
+
+    for (int i = closed ? 0 : 1; i < (closed ? count : count - 1); i++) {
+        const QPointF &point = points.at(i);
+        if (!corners.at(i)) {
+            addDisc(point, halfWidth);
+            continue;
+        }
+        QPointF in = normalized(point - points.at((i + count - 1) % count));
+        QPointF out = normalized(points.at((i + 1) % count) - point);
+        addJoin(point, in, out, stroke);
+    }
+}
+
+void StrokeDistanceField::addSegment(const QPointF &from, const QPointF &to, qreal startExtension,
+                                     qreal endExtension, qreal halfWidth)
+{
+    QPointF axis = normalized(to - from);
+    QPointF start = from - axis * startExtension;
+    QPointF end = to + axis * endExtension;
+
+    Primitive box;
+    box.type = Primitive::Box;
+    box.center = (start + end) / 2;
+    box.axis = axis;
+    box.halfLength = sqrt(dot(end - start, end - start)) / 2;
+    box.halfWidth = halfWidth;
+
+    QRectF bounds = QRectF(start, end).normalized();
+    insert(box, bounds.adjusted(-halfWidth, -halfWidth, halfWidth, halfWidth));
+}
+
+void StrokeDistanceField::addDisc(const QPointF &center, qreal radius)
+{
+    Primitive disc;
+    disc.type = Primitive::Disc;
+    disc.center = center;
+    disc.halfWidth = radius;
+    insert(disc, QRectF(center.x() - radius, center.y() - radius, 2 * radius, 2 * radius));
+}
+
+void StrokeDistanceField::addJoin(const QPointF &point, const QPointF &in, const QPointF &out,
+                                  const StrokeGeometry &stroke)
+{
+    qreal halfWidth = stroke.width / 2;
+    if (stroke.joinStyle == Qt::RoundJoin) {
+        addDisc(point, halfWidth);
+        return;
+    }
+
+    // Straight continuations need no join and full reversals only get a bevel,
+    // which the segment boxes already cover
+    qreal turn = cross(in, out);
+    if (fabs(turn) < 1e-9)
+        return;
+
+    // Normals pointing to the outer side of the turn
+    QPointF inNormal(-in.y(), in.x());
+    QPointF outNormal(-out.y(), out.x());
+    if (turn > 0) {
+        inNormal = -inNormal;
+        outNormal = -outNormal;
+    }
+
+    QPointF a = point + inNormal * halfWidth;
+    QPointF b = point + outNormal * halfWidth;
+    QPolygonF join;
+    join << point << a;
+
+    if (stroke.joinStyle == Qt::MiterJoin || stroke.joinStyle == Qt::SvgMiterJoin) {
+        // The miter limit is the length of the miter relative to the stroke width
+        QPointF bisector = normalized(inNormal + outNormal);
+        qreal cosine = dot(bisector, inNormal);
+        qreal ratio = 1.0 / cosine;
+        QPointF tip = point + bisector * halfWidth * ratio;
+        if (ratio <= stroke.miterLimit) {
+            join << tip;
+        } else if (stroke.joinStyle == Qt::MiterJoin) {
+            // Cut the miter off at the limit, SVG miters turn into bevels instead
+            qreal t = (stroke.miterLimit - cosine) / (ratio - cosine);
+            if (t > 0.0)
+                join << a + (tip - a) * t << b + (tip - b) * t;
+        }
+    }
+
+    join << b;
+    addPolygon(join);
+}
+
+void StrokeDistanceField::addPolygon(const QPolygonF &polygon)
+{
+    Primitive primitive;
+    primitive.type = Primitive::Polygon;
+    primitive.polygon = polygon;
+    insert(primitive, polygon.boundingRect());
+}
+
+void StrokeDistanceField::insert(const Primitive &primitive, const QRectF &bounds)
+{
+    // Only primitives closer than the maximum distance affect a point
+    m_grid.insert(m_primitives.size(), bounds.adjusted(-m_maxDist, -m_maxDist, m_maxDist, m_maxDist));
+    m_primitives.push_back(primitive);
+}
+
+static inline qreal sign(qreal value)
+{
+    return value < 0.0 ? -1.0 : 1.0;
+}
+
+// Signed distance to a simple polygon, negative inside. The gradient of the
+// distance is stored into gradient.
+static qreal polygonDistance(const QPolygonF &polygon, const QPointF &point, QPointF *gradient)
+{
+    int count = polygon.count();
+    QPointF nearest = point - polygon.first();
+    qreal squared = dot(nearest, nearest);
+    qreal sign = 1.0;
+    for (int i = 0, j = count - 1; i < count; j = i, i++) {
+        QPointF edge = polygon.at(j) - polygon.at(i);
+        QPointF w = point - polygon.at(i);
+        qreal length = dot(edge, edge);
+        qreal t = length > 0.0 ? qBound(0.0, dot(w, edge) / length, 1.0) : 0.0;
+        QPointF b = w - edge * t;
+        if (dot(b, b) < squared) {
+            squared = dot(b, b);
+            nearest = b;
+        }
+
+        // Crossing test for the inside-ness
+        bool above = point.y() >= polygon.at(i).y();
+        bool below = point.y() < polygon.at(j).y();
+        bool left = edge.x() * w.y() > edge.y() * w.x();
+        if ((above && below && left) || (!above && !below && !left))
+            sign = -sign;
+    }
+
+    qreal distance = sqrt(squared);
+    *gradient = distance > 0.0 ? nearest * (sign / distance) : QPointF();
+    return sign * distance;
+}
+
+float StrokeDistanceField::distance(const QPointF &point, QPointF *gradient) const
+{
+    // Union of the primitives: the nearest one wins, both outside and inside
+    qreal nearest = m_maxDist;
+    QPointF nearestGradient;
+    int cell = m_grid.cellAt(point);
+    if (cell >= 0) {
+        for (int index : m_grid.items(cell)) {
+            const Primitive &primitive = m_primitives[index];
+            qreal d = m_maxDist;
+            QPointF g;
+            switch (primitive.type) {
+            case Primitive::Box: {
+                QPointF offset = point - primitive.center;
+                QPointF normal(-primitive.axis.y(), primitive.axis.x());
+                qreal along = dot(offset, primitive.axis);
+                qreal across = dot(offset, normal);
+                qreal x = fabs(along) - primitive.halfLength;
+                qreal y = fabs(across) - primitive.halfWidth;
+                qreal outside = hypot(qMax(x, 0.0), qMax(y, 0.0));
+                d = outside + qMin(qMax(x, y), 0.0);
+                if (outside > 0.0) {
+                    g = (qMax(x, 0.0) * sign(along) * primitive.axis
+                         + qMax(y, 0.0) * sign(across) * normal) / outside;
+                } else {
+                    g = x > y ? sign(along) * primitive.axis : sign(across) * normal;
+                }
+                break;
+            }
+            case Primitive::Disc: {
+                QPointF offset = point - primitive.center;
+                qreal length = sqrt(dot(offset, offset));
+                d = length - primitive.halfWidth;
+                g = length > 0.0 ? offset / length : QPointF();
+                break;
+            }
+            case Primitive::Polygon:
+                d = polygonDistance(primitive.polygon, point, &g);
+                break;
+            }
+            if (d < nearest) {
+                nearest = d;
+                nearestGradient = g;
+            }
+        }
+    }
+
+    // Distances are positive inside the shape, so the field grows against
+    // the gradient of the signed distance functions
+    if (gradient)
+        *gradient = -nearestGradient;
+    return -nearest;
+}
+
+void StrokeDistanceField::render(const QRectF &sourceRect, QImage *field, int numThreads,
+                                 QImage *gradient) const
+{
+    uchar *bits = field->bits();
+    int bytesPerLine = field->bytesPerLine();
+    int width = field->width();
+    int height = field->height();
+    qreal xScale = sourceRect.width() / width;
+    qreal yScale = sourceRect.height() / height;
+
+    runThreads(numThreads, [&](int threadId) {
+        for (int y = threadId; y < height; y += numThreads) {
+            uchar *line = bits + y * bytesPerLine;
+            QRgba64 *gradientLine = gradient ? reinterpret_cast<QRgba64 *>(gradient->scanLine(y)) : nullptr;
+            qreal sourceY = sourceRect.top() + (y + 0.5) * yScale;
+            for (int x = 0; x < width; x++) {
+                QPointF point(sourceRect.left() + (x + 0.5) * xScale, sourceY);
+                QPointF direction;
+                line[x] = encodeDistance(distance(point, &direction), m_maxDist);
+                if (gradientLine)
+                    gradientLine[x] = encodeGradient(direction.x(), direction.y());
+            }
+        }
+    });
+}
@@ -0,0 +1,90 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef STROKEDISTANCE_H
+#define STROKEDISTANCE_H
+
+#include "shape.h"
+#include "spatialgrid.h"
+
+#include <QImage>
+#include <QPolygonF>
+#include <vector>
+
+// Computes the distance field of stroked paths directly from their centerlines.
+// Each stroke is decomposed into primitives with exact signed distance functions
+// (a box per line segment, discs for round joins and caps, convex polygons for
+// miter and bevel joins) and the field is only evaluated at the output texels,
+// so no source buffer gets rasterized at all.
+class StrokeDistanceField
+{
+public:
+    // area is the padded source buffer in which the strokes are given, and
+    // distances are clamped to maxDist source pixels.
+    StrokeDistanceField(const QRect &area, float maxDist);
+
+    // Returns true if the shapes are all opaque enough strokes with a known
+    // centerline whose color counts as inside the shape.
+    static bool canRender(const QVector<Shape> &shapes, bool negate);
+
+    void addStroke(const StrokeGeometry &stroke);
+
+    // Evaluates the field at the texel centers of field, which covers
+    // sourceRect of the source buffer. Values are mapped like the brute
+    // force search maps them, with the strokes on the high side. The
+    // gradient image, if given, must have the size of field.
+    void render(const QRectF &sourceRect, QImage *field, int numThreads,
+                QImage *gradient = nullptr) const;
+
+private:
+    struct Primitive
+    {
+        enum Type { Box, Disc, Polygon };
+        Type type;
+        QPointF center;
+        QPointF axis;
+        qreal halfLength;
+        qreal halfWidth;
+        QPolygonF polygon;
+    };
+
+    void addSubpath(const QPolygonF &points, const QVector<bool> &corners,
+                    const StrokeGeometry &stroke);
+    void addSegment(const QPointF &from, const QPointF &to, qreal startExtension,
+                    qreal endExtension, qreal halfWidth);
+    void addDisc(const QPointF &center, qreal radius);
+    void addJoin(const QPointF &point, const QPointF &in, const QPointF &out,
+                 const StrokeGeometry &stroke);
+    void addPolygon(const QPolygonF &polygon);
+    void insert(const Primitive &primitive, const QRectF &bounds);
+
+    float distance(const QPointF &point, QPointF *gradient) const;
+
+    float m_maxDist;
+    SpatialGrid m_grid;
+    std::vector<Primitive> m_primitives;
+};
+
+#endif // STROKEDISTANCE_H
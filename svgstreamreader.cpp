@@ -0,0 +1,758 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "svgstreamreader.h"
+
+#include <QIODevice>
+#include <QPainterPathStroker>
+#include <ctype.h>
+#include <math.h>
+
+namespace {
+
+// Splits SVG attribute values such as path data, point lists and transforms into
+// numbers, flags and identifiers. Parses numbers by hand, since strtod and friends
+// follow the C locale which QCoreApplication sets from the environment.
+class Tokenizer
+{
+public:
+    explicit Tokenizer(const QStringRef &value) :
+        m_data(value.toLatin1()),
+        m_pos(m_data.constData()),
+        m_end(m_pos + m_data.size())
+    {
+    }
+
+    void skipSeparators()
+    {
+        while (m_pos < m_end && (isspace(uchar(*m_pos)) || *m_pos == ','))
+            m_pos++;
+    }
+
+    bool atEnd()
+    {
+        skipSeparators();
+        return m_pos == m_end;
+    }
+
+    char peek()
+    {
+        skipSeparators();
+        return m_pos < m_end ? *m_pos : 0;
+    }
+
+    char next()
+    {
+        skipSeparators();
+        return m_pos < m_end ? *m_pos++ : 0;
+    }
+
+    bool readNumber(qreal *result)
+    {
+        skipSeparators();
+        const char *p = m_pos;
+        bool negative = false;
+        if (p < m_end && (*p == '+' || *p == '-'))
+            negative = *p++ == '-';
+
+        qreal value = 0.0;
+        bool hasDigits = false;
+        while (p < m_end && isdigit(uchar(*p))) {
+            value = value * 10.0 + (*p++ - '0');
+            hasDigits = true;
+        }
+        if (p < m_end && *p == '.') {
+            p++;
+            qreal scale = 0.1;
+            while (p < m_end && isdigit(uchar(*p))) {
+                value += (*p++ - '0') * scale;
+                scale *= 0.1;
+                hasDigits = true;
+            }
+        }
+        if (!hasDigits)
+            return false;
+
+        // An exponent, unless the e belongs to an em or ex unit
+        if (p < m_end && (*p == 'e' || *p == 'E')) {
+            const char *e = p + 1;
+            bool negativeExponent = false;
+            if (e < m_end && (*e == '+' || *e == '-'))
+                negativeExponent = *e++ == '-';
+            if (e < m_end && isdigit(uchar(*e))) {
+                int exponent = 0;
+                while (e < m_end && isdigit(uchar(*e)))
+                    exponent = exponent * 10 + (*e++ - '0');
+                value *= pow(10.0, negativeExponent ? -exponent : exponent);
+                p = e;
+            }
+        }
+
+        *result = negative ? -value : value;
+        m_pos = p;
+        return true;
+    }
+
+    // Arc flags are single digits which may be written without separators
+    bool readFlag(bool *result)
+    {
+        skipSeparators();
+        if (m_pos == m_end || (*m_pos != '0' && *m_pos != '1'))
+            return false;
+        *result = *m_pos++ == '1';
+        return true;
+    }
+
+    QByteArray readIdentifier()
+    {
+        skipSeparators();
+        const char *start = m_pos;
+        while (m_pos < m_end && (isalpha(uchar(*m_pos)) || *m_pos == '%'))
+            m_pos++;
+        return QByteArray(start, m_pos - start);
+    }
+
+private:
+    QByteArray m_data;
+    const char *m_pos;
+    const char *m_end;
+};
+
+QPointF mapArcPoint(qreal x, qreal y, const QPointF &center, qreal rx, qreal ry,
+                    qreal cosPhi, qreal sinPhi)
+{
+    return QPointF(center.x() + rx * x * cosPhi - ry * y * sinPhi,
+                   center.y() + rx * x * sinPhi + ry * y * cosPhi);
+}
+
+// Appends an SVG elliptical arc as cubic Béziers following the endpoint to center
+// parameterization conversion of the SVG implementation notes.
+void arcTo(QPainterPath *path, const QPointF &from, qreal rx, qreal ry, qreal rotation,
+           bool largeArc, bool sweep, const QPointF &to)
+{
+    if (from == to)
+        return;
+
+    rx = fabs(rx);
+    ry = fabs(ry);
+    if (rx == 0.0 || ry == 0.0) {
+        path->lineTo(to);
+        return;
+    }
+
+    qreal phi = rotation * M_PI / 180.0;
+    qreal cosPhi = cos(phi);
+    qreal sinPhi = sin(phi);
+    qreal dx2 = (from.x() - to.x()) / 2.0;
+    qreal dy2 = (from.y() - to.y()) / 2.0;
+    qreal x1 = cosPhi * dx2 + sinPhi * dy2;
+    qreal y1 = -sinPhi * dx2 + cosPhi * dy2;
+
+    // Scale up radii which are too small to reach the end point
+    qreal lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+    if (lambda > 1.0) {
+        rx *= sqrt(lambda);
+        ry *= sqrt(lambda);
+    }
+
+    qreal numerator = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+    qreal denominator = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+    qreal coefficient = sqrt(qMax<qreal>(0.0, numerator / denominator));
+    if (largeArc == sweep)
+        coefficient = -coefficient;
+    qreal cx1 = coefficient * rx * y1 / ry;
+    qreal cy1 = -coefficient * ry * x1 / rx;
+    QPointF center(cosPhi * cx1 - sinPhi * cy1 + (from.x() + to.x()) / 2.0,
+                   sinPhi * cx1 + cosPhi * cy1 + (from.y() + to.y()) / 2.0);
+
+    qreal ux = (x1 - cx1) / rx, uy = (y1 - cy1) / ry;
+    qreal vx = (-x1 - cx1) / rx, vy = (-y1 - cy1) / ry;
+    qreal startAngle = atan2(uy, ux);
+    qreal sweepAngle = atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+    if (!sweep && sweepAngle > 0.0)
+        sweepAngle -= 2.0 * M_PI;
+    else if (sweep && sweepAngle < 0.0)
+        sweepAngle += 2.0 * M_PI;
+
+    int segments = qMax(1, int(ceil(fabs(sweepAngle) / (M_PI / 2.0) - 1e-6)));
+    qreal delta = sweepAngle / segments;
+    qreal k = 4.0 / 3.0 * tan(delta / 4.0);
+    for (int i = 0; i < segments; i++) {
+        qreal a1 = startAngle + i * delta;
+        qreal a2 = a1 + delta;
+        QPointF c1 = mapArcPoint(cos(a1) - k * sin(a1), sin(a1) + k * cos(a1),
+                                 center, rx, ry, cosPhi, sinPhi);
+        QPointF c2 = mapArcPoint(cos(a2) + k * sin(a2), sin(a2) - k * cos(a2),
+                                 center, rx, ry, cosPhi, sinPhi);
+        QPointF end = i == segments - 1 ? to : mapArcPoint(cos(a2), sin(a2), center,
+                                                           rx, ry, cosPhi, sinPhi);
+        path->cubicTo(c1, c2, end);
+    }
+}
+
+// Parses path data into path. On errors the path is rendered up to the error
+// as the SVG specification requires.
+void parsePathData(const QStringRef &data, QPainterPath *path)
+{
+    Tokenizer tokens(data);
+    char command = 0;
+    char previousCommand = 0;
+    QPointF current;
+    QPointF subpathStart;
+    QPointF lastControl;
+
+    while (!tokens.atEnd()) {
+        if (isalpha(uchar(tokens.peek())))
+            command = tokens.next();
+        else if (command == 0)
+            return;
+
+        bool relative = islower(uchar(command));
+        QPointF origin = relative ? current : QPointF();
+        char absoluteCommand = toupper(uchar(command));
+        qreal v[5];
+        bool flags[2];
+
+        switch (absoluteCommand) {
+        case 'M':
+            if (!tokens.readNumber(&v[0]) || !tokens.readNumber(&v[1]))
+                return;
+            current = origin + QPointF(v[0], v[1]);
+            subpathStart = current;
+            path->moveTo(current);
+            // Coordinates following a moveto are implicit linetos
+            command = relative ? 'l' : 'L';
+            break;
+        case 'L':
+            if (!tokens.readNumber(&v[0]) || !tokens.readNumber(&v[1]))
+                return;
+            current = origin + QPointF(v[0], v[1]);
+            path->lineTo(current);
+            break;
+        case 'H':
+            if (!tokens.readNumber(&v[0]))
+                return;
+            current.setX(origin.x() + v[0]);
+            path->lineTo(current);
+            break;
+        case 'V':
+            if (!tokens.readNumber(&v[0]))
+                return;
+            current.setY(origin.y() + v[0]);
+            path->lineTo(current);
+            break;
+        case 'C':
+        case 'S': {
+            QPointF c1;
+            if (absoluteCommand == 'C') {
+                if (!tokens.readNumber(&v[0]) || !tokens.readNumber(&v[1]))
+                    return;
+                c1 = origin + QPointF(v[0], v[1]);
+            } else {
+                bool smooth = previousCommand == 'C' || previousCommand == 'S';
+                c1 = smooth ? current * 2.0 - lastControl : current;
+            }
+            for (int i = 0; i < 4; i++) {
+                if (!tokens.readNumber(&v[i]))
+                    return;
+            }
+            lastControl = origin + QPointF(v[0], v[1]);
+            current = origin + QPointF(v[2], v[3]);
+            path->cubicTo(c1, lastControl, current);
+            break;
+        }
+        case 'Q':
+        case 'T': {
+            if (absoluteCommand == 'Q') {
+                if (!tokens.readNumber(&v[0]) || !tokens.readNumber(&v[1]))
+                    return;
+                lastControl = origin + QPointF(v[0], v[1]);
+            } else {
+                bool smooth = previousCommand == 'Q' || previousCommand == 'T';
+                lastControl = smooth ? current * 2.0 - lastControl : current;
+            }
+            if (!tokens.readNumber(&v[2]) || !tokens.readNumber(&v[3]))
+                return;
+            current = origin + QPointF(v[2], v[3]);
+            path->quadTo(lastControl, current);
+            break;
+        }
+        case 'A':
+            if (!tokens.readNumber(&v[0]) || !tokens.readNumber(&v[1]) || !tokens.readNumber(&v[2])
+                    || !tokens.readFlag(&flags[0]) || !tokens.readFlag(&flags[1])
+                    || !tokens.readNumber(&v[3]) || !tokens.readNumber(&v[4])) {
+                return;
+            }
+            arcTo(path, current, v[0], v[1], v[2], flags[0], flags[1], origin + QPointF(v[3], v[4]));
+            current = origin + QPointF(v[3], v[4]);
+            break;
+        case 'Z':
+            path->closeSubpath();
+            current = subpathStart;
+            // Numbers can't follow a closepath without a new command
+            command = 0;
+            break;
+        default:
+            return;
+        }
+        previousCommand = absoluteCommand;
+    }
+}
+
+QPolygonF parsePoints(const QStringRef &data)
+{
+    Tokenizer tokens(data);
+    QPolygonF points;
+    qreal x, y;
+    while (tokens.readNumber(&x) && tokens.readNumber(&y))
+        points.append(QPointF(x, y));
+    return points;
+}
+
+QTransform parseTransform(const QStringRef &data)
+{
+    Tokenizer tokens(data);
+    QTransform result;
+    while (!tokens.atEnd()) {
+        QByteArray name = tokens.readIdentifier();
+        if (name.isEmpty() || tokens.next() != '(')
+            break;
+
+        QVector<qreal> args;
+        qreal value;
+        while (tokens.readNumber(&value))
+            args.append(value);
+        if (tokens.next() != ')' || args.isEmpty())
+            break;
+
+        QTransform transform;
+        if (name == "matrix" && args.count() == 6) {
+            transform = QTransform(args[0], args[1], args[2], args[3], args[4], args[5]);
+        } else if (name == "translate") {
+            transform.translate(args[0], args.value(1));
+        } else if (name == "scale") {
+            transform.scale(args[0], args.count() > 1 ? args[1] : args[0]);
+        } else if (name == "rotate") {
+            transform.translate(args.value(1), args.value(2));
+            transform.rotate(args[0]);
+            transform.translate(-args.value(1), -args.value(2));
+        } else if (name == "skewX") {
+            transform.shear(tan(args[0] * M_PI / 180.0), 0.0);
+        } else if (name == "skewY") {
+            transform.shear(0.0, tan(args[0] * M_PI / 180.0));
+        }
+
+        // The rightmost transform of the list gets applied first
+        result = transform * result;
+    }
+    return result;
+}
+
+bool isSkippedElement(const QStringRef &name)
+{
+    static const char *const skipped[] = {
+        "defs", "clipPath", "mask", "symbol", "pattern", "marker", "linearGradient",
+        "radialGradient", "filter", "style", "script", "text", "use", "image", "title",
+        "desc", "metadata", "foreignObject"
+    };
+    for (const char *element : skipped) {
+        if (name == QLatin1String(element))
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+SvgStreamReader::SvgStreamReader(QIODevice *device) :
+    m_xml(device)
+{
+}
+
+SvgStreamReader::~SvgStreamReader()
+{
+}
+
+bool SvgStreamReader::readHeader()
+{
+    while (!m_xml.atEnd()) {
+        if (m_xml.readNext() != QXmlStreamReader::StartElement)
+            continue;
+        if (m_xml.name() != QLatin1String("svg"))
+            return false;
+
+        QXmlStreamAttributes attributes = m_xml.attributes();
+        Tokenizer viewBox(attributes.value(QLatin1String("viewBox")));
+        qreal v[4];
+        if (viewBox.readNumber(&v[0]) && viewBox.readNumber(&v[1]) && viewBox.readNumber(&v[2])
+                && viewBox.readNumber(&v[3]) && v[2] > 0.0 && v[3] > 0.0) {
+            m_viewBox = QRectF(v[0], v[1], v[2], v[3]);
+        }
+
+        QStringRef width = attributes.value(QLatin1String("width"));
+        QStringRef height = attributes.value(QLatin1String("height"));
+        m_size = QSizeF(width.isEmpty() || width.endsWith('%') ? 0.0 : parseLength(width, 0.0),
+                        height.isEmpty() || height.endsWith('%') ? 0.0 : parseLength(height, 0.0));
+        if (m_size.width() <= 0.0)
+            m_size.setWidth(m_viewBox.isValid() ? m_viewBox.width() : 100.0);
+        if (m_size.height() <= 0.0)
+            m_size.setHeight(m_viewBox.isValid() ? m_viewBox.height() : 100.0);
+        if (!m_viewBox.isValid())
+            m_viewBox = QRectF(QPointF(0.0, 0.0), m_size);
+
+        PaintState root;
+        applyAttributes(&root);
+        m_stateStack.append(root);
+        return true;
+    }
+    return false;
+}
+
+QSize SvgStreamReader::defaultSize() const
+{
+    return m_size.toSize();
+}
+
+void SvgStreamReader::setTargetRect(const QRectF &rect)
+{
+    m_deviceTransform = QTransform::fromTranslate(-m_viewBox.x(), -m_viewBox.y())
+            * QTransform::fromScale(rect.width() / m_viewBox.width(), rect.height() / m_viewBox.height())
+            * QTransform::fromTranslate(rect.x(), rect.y());
+}
+
+bool SvgStreamReader::readShapes(QVector<Shape> *shapes, int maxCount)
+{
+    int initialCount = shapes->count();
+    while (shapes->count() - initialCount < maxCount && !m_xml.atEnd()) {
+        QXmlStreamReader::TokenType token = m_xml.readNext();
+        if (token == QXmlStreamReader::StartElement)
+            readElement(shapes);
+        else if (token == QXmlStreamReader::EndElement && !m_stateStack.isEmpty())
+            m_stateStack.removeLast();
+    }
+    return shapes->count() > initialCount;
+}
+
+bool SvgStreamReader::hasError() const
+{
+    return m_xml.hasError();
+}
+
+QString SvgStreamReader::errorString() const
+{
+    return QString("%1 at line %2").arg(m_xml.errorString()).arg(int(m_xml.lineNumber()));
+}
+
+void SvgStreamReader::readElement(QVector<Shape> *shapes)
+{
+    QStringRef name = m_xml.name();
+    if (isSkippedElement(name)) {
+        if (name == QLatin1String("use") || name == QLatin1String("text")
+                || name == QLatin1String("image") || name == QLatin1String("style")) {
+            warnUnsupported(QString("<%1> elements").arg(name.toString()));
+        }
+        m_xml.skipCurrentElement();
+        return;
+    }
+
+    PaintState state = m_stateStack.isEmpty() ? PaintState() : m_stateStack.last();
+    applyAttributes(&state);
+    if (m_stateStack.count() == 1)
+        state.layer = m_xml.attributes().value(QLatin1String("id")).toString();
+    if (!state.displayed) {
+        m_xml.skipCurrentElement();
+        return;
+    }
+    m_stateStack.append(state);
+
+    QXmlStreamAttributes attributes = m_xml.attributes();
+    auto length = [&](const char *attribute, qreal percentBase) {
+        return parseLength(attributes.value(QLatin1String(attribute)), percentBase);
+    };
+    qreal viewBoxWidth = m_viewBox.width();
+    qreal viewBoxHeight = m_viewBox.height();
+    qreal viewBoxDiagonal = sqrt((viewBoxWidth * viewBoxWidth + viewBoxHeight * viewBoxHeight) / 2.0);
+
+    QPainterPath path;
+    if (name == QLatin1String("path")) {
+        parsePathData(attributes.value(QLatin1String("d")), &path);
+        addShapes(path, true, shapes);
+    } else if (name == QLatin1String("rect")) {
+        QRectF rect(length("x", viewBoxWidth), length("y", viewBoxHeight),
+                    length("width", viewBoxWidth), length("height", viewBoxHeight));
+        qreal rx = length("rx", viewBoxWidth);
+        qreal ry = length("ry", viewBoxHeight);
+        if (attributes.value(QLatin1String("rx")).isEmpty())
+            rx = ry;
+        if (attributes.value(QLatin1String("ry")).isEmpty())
+            ry = rx;
+        if (rect.isValid()) {
+            if (rx > 0.0 && ry > 0.0)
+                path.addRoundedRect(rect, qMin(rx, rect.width() / 2.0), qMin(ry, rect.height() / 2.0));
+            else
+                path.addRect(rect);
+            addShapes(path, true, shapes);
+        }
+    } else if (name == QLatin1String("circle") || name == QLatin1String("ellipse")) {
+        QPointF center(length("cx", viewBoxWidth), length("cy", viewBoxHeight));
+        qreal rx, ry;
+        if (name == QLatin1String("circle")) {
+            rx = ry = length("r", viewBoxDiagonal);
+        } else {
+            rx = length("rx", viewBoxWidth);
+            ry = length("ry", viewBoxHeight);
+        }
+        if (rx > 0.0 && ry > 0.0) {
+            path.addEllipse(center, rx, ry);
+            addShapes(path, true, shapes);
+        }
+    } else if (name == QLatin1String("line")) {
+        path.moveTo(length("x1", viewBoxWidth), length("y1", viewBoxHeight));
+        path.lineTo(length("x2", viewBoxWidth), length("y2", viewBoxHeight));
+        addShapes(path, false, shapes);
+    } else if (name == QLatin1String("polyline") || name == QLatin1String("polygon")) {
+        QPolygonF points = parsePoints(attributes.value(QLatin1String("points")));
+        if (points.count() > 1) {
+            path.addPolygon(points);
+            if (name == QLatin1String("polygon"))
+                path.closeSubpath();
+            addShapes(path, true, shapes);
+        }
+    }
+}
+
+void SvgStreamReader::addShapes(const QPainterPath &path, bool fillable, QVector<Shape> *shapes)
+{
+    const PaintState &state = m_stateStack.last();
+    if (!state.visible || path.isEmpty())
+        return;
+
+    QTransform transform = state.transform * m_deviceTransform;
+
+    QColor fill = state.fillIsCurrentColor ? state.color : state.fill;
+    if (fillable && fill.isValid()) {
+        float opacity = state.opacity * state.fillOpacity * fill.alphaF();
+        if (opacity > 0.0f) {
+            QPainterPath fillPath = path;
+            fillPath.setFillRule(state.fillRule);
+            shapes->append(shapeFromPath(transform.map(fillPath), fill.rgb(), opacity));
+            shapes->last().layer = state.layer;
+        }
+    }
+
+    QColor stroke = state.strokeIsCurrentColor ? state.color : state.stroke;
+    if (stroke.isValid() && state.strokeWidth > 0.0) {
+        float opacity = state.opacity * state.strokeOpacity * stroke.alphaF();
+        if (opacity > 0.0f) {
+            QPainterPathStroker stroker;
+            stroker.setWidth(state.strokeWidth);
+            stroker.setCapStyle(state.capStyle);
+            stroker.setJoinStyle(state.joinStyle);
+            stroker.setMiterLimit(state.miterLimit);
+            if (!state.dashPattern.isEmpty()) {
+                // QPainterPathStroker measures dashes in stroke widths
+                QVector<qreal> dashes = state.dashPattern;
+                for (qreal &dash : dashes)
+                    dash /= state.strokeWidth;
+                stroker.setDashPattern(dashes);
+            }
+            shapes->append(shapeFromPath(transform.map(stroker.createStroke(path)), stroke.rgb(), opacity));
+            shapes->last().layer = state.layer;
+            if (state.dashPattern.isEmpty())
+                setStrokeGeometry(&shapes->last(), path, transform, state.strokeWidth,
+                                  state.capStyle, state.joinStyle, state.miterLimit);
+        }
+    }
+}
+
+qreal SvgStreamReader::parseLength(const QStringRef &value, qreal percentBase) const
+{
+    Tokenizer tokens(value);
+    qreal length;
+    if (!tokens.readNumber(&length))
+        return 0.0;
+
+    // Absolute units are converted at 90 dpi like QtSvg does
+    QByteArray unit = tokens.readIdentifier();
+    if (unit == "pt")
+        return length * 1.25;
+    if (unit == "pc")
+        return length * 15.0;
+    if (unit == "mm")
+        return length * 3.543307;
+    if (unit == "cm")
+        return length * 35.43307;
+    if (unit == "in")
+        return length * 90.0;
+    if (unit == "%")
+        return length * percentBase / 100.0;
+    if (unit == "em")
+        return length * 16.0;
+    if (unit == "ex")
+        return length * 8.0;
+    return length;
+}
+
+void SvgStreamReader::applyAttributes(PaintState *state)
+{
+    QXmlStreamAttributes attributes = m_xml.attributes();
+
+    QStringRef transform = attributes.value(QLatin1String("transform"));
+    if (!transform.isEmpty())
+        state->transform = parseTransform(transform) * state->transform;
+
+    // Presentation attributes first, so that the style attribute can override
+    // them. The element's own opacity is resolved before it gets multiplied
+    // into the inherited one.
+    qreal inheritedOpacity = state->opacity;
+    state->opacity = 1.0;
+    for (const QXmlStreamAttribute &attribute : attributes)
+        applyProperty(state, attribute.name(), attribute.value());
+
+    QStringRef style = attributes.value(QLatin1String("style"));
+    for (const QStringRef &declaration : style.split(';')) {
+        int colon = declaration.indexOf(':');
+        if (colon > 0)
+            applyProperty(state, declaration.left(colon).trimmed(), declaration.mid(colon + 1).trimmed());
+    }
+    state->opacity *= inheritedOpacity;
+}
+
+void SvgStreamReader::applyProperty(PaintState *state, const QStringRef &name, const QStringRef &value)
+{
+    if (value == QLatin1String("inherit"))
+        return;
+
+    qreal number;
+    Tokenizer tokens(value);
+
+    if (name == QLatin1String("color")) {
+        bool isCurrentColor;
+        QColor color;
+        if (parsePaint(value, &color, &isCurrentColor) && !isCurrentColor)
+            state->color = color;
+    } else if (name == QLatin1String("fill")) {
+        parsePaint(value, &state->fill, &state->fillIsCurrentColor);
+    } else if (name == QLatin1String("stroke")) {
+        parsePaint(value, &state->stroke, &state->strokeIsCurrentColor);
+    } else if (name == QLatin1String("fill-rule")) {
+        state->fillRule = value == QLatin1String("evenodd") ? Qt::OddEvenFill : Qt::WindingFill;
+    } else if (name == QLatin1String("fill-opacity")) {
+        if (tokens.readNumber(&number))
+            state->fillOpacity = qBound(0.0, number, 1.0);
+    } else if (name == QLatin1String("stroke-opacity")) {
+        if (tokens.readNumber(&number))
+            state->strokeOpacity = qBound(0.0, number, 1.0);
+    } else if (name == QLatin1String("opacity")) {
+        // Group opacity is approximated by multiplying it into the children
+        if (tokens.readNumber(&number))
+            state->opacity = qBound(0.0, number, 1.0);
+    } else if (name == QLatin1String("stroke-width")) {
+        state->strokeWidth = parseLength(value, sqrt((m_viewBox.width() * m_viewBox.width()
+                                                      + m_viewBox.height() * m_viewBox.height()) / 2.0));
+    } else if (name == QLatin1String("stroke-linecap")) {
+        if (value == QLatin1String("round"))
+            state->capStyle = Qt::RoundCap;
+        else if (value == QLatin1String("square"))
+            state->capStyle = Qt::SquareCap;
+        else
+            state->capStyle = Qt::FlatCap;
+    } else if (name == QLatin1String("stroke-linejoin")) {
+        if (value == QLatin1String("round"))
+            state->joinStyle = Qt::RoundJoin;
+        else if (value == QLatin1String("bevel"))
+            state->joinStyle = Qt::BevelJoin;
+        else
+            state->joinStyle = Qt::SvgMiterJoin;
+    } else if (name == QLatin1String("stroke-miterlimit")) {
+        if (tokens.readNumber(&number))
+            state->miterLimit = qMax(1.0, number);
+    } else if (name == QLatin1String("stroke-dasharray")) {
+        // Kept in user units, as the stroke width may still change
+        state->dashPattern.clear();
+        while (tokens.readNumber(&number))
+            state->dashPattern.append(number);
+        if (state->dashPattern.count() % 2) {
+            QVector<qreal> pattern = state->dashPattern;
+            state->dashPattern += pattern;
+        }
+    } else if (name == QLatin1String("display")) {
+        state->displayed = value != QLatin1String("none");
+    } else if (name == QLatin1String("visibility")) {
+        state->visible = value == QLatin1String("visible");
+    }
+}
+
+bool SvgStreamReader::parsePaint(const QStringRef &value, QColor *color, bool *isCurrentColor)
+{
+    QStringRef paint = value.trimmed();
+    *isCurrentColor = false;
+
+    if (paint.startsWith(QLatin1String("url("))) {
+        // Paint servers aren't resolved while streaming, use the fallback color if any
+        int end = paint.indexOf(')');
+        QStringRef fallback = end > 0 ? paint.mid(end + 1).trimmed() : QStringRef();
+        if (fallback.isEmpty()) {
+            warnUnsupported("gradient and pattern paints");
+            *color = QColor();
+            return true;
+        }
+        paint = fallback;
+    }
+
+    if (paint == QLatin1String("none")) {
+        *color = QColor();
+    } else if (paint == QLatin1String("currentColor")) {
+        *isCurrentColor = true;
+    } else if (paint.startsWith(QLatin1String("rgb("))) {
+        Tokenizer tokens(paint.mid(4));
+        int rgb[3];
+        for (int i = 0; i < 3; i++) {
+            qreal component;
+            if (!tokens.readNumber(&component))
+                return false;
+            if (tokens.peek() == '%') {
+                tokens.next();
+                component *= 2.55;
+            }
+            rgb[i] = qBound(0, qRound(component), 255);
+        }
+        *color = QColor(rgb[0], rgb[1], rgb[2]);
+    } else {
+        QColor parsed(paint.toString());
+        if (!parsed.isValid())
+            return false;
+        *color = parsed;
+    }
+    return true;
+}
+
+void SvgStreamReader::warnUnsupported(const QString &what)
+{
+    if (m_warnedAbout.contains(what))
+        return;
+    m_warnedAbout.insert(what);
+    qWarning("The streaming SVG parser ignores %s", qPrintable(what));
+}
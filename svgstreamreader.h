@@ -0,0 +1,108 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SVGSTREAMREADER_H
+#define SVGSTREAMREADER_H
+
+#include "shape.h"
+
+#include <QXmlStreamReader>
+#include <QTransform>
+#include <QColor>
+#include <QSet>
+#include <QVector>
+
+class QIODevice;
+
+// Reads the geometry of an SVG document element by element without building
+// a document tree, so memory use only depends on the shapes handed out in one
+// batch. Supports paths, basic shapes, groups, transforms and solid fills and
+// strokes with the usual presentation attributes. Definitions, references,
+// gradients, text and CSS style sheets are skipped.
+class SvgStreamReader
+{
+public:
+    explicit SvgStreamReader(QIODevice *device);
+    ~SvgStreamReader();
+
+    // Reads up to and including the root element. Returns false if the
+    // document doesn't start with an <svg> element.
+    bool readHeader();
+
+    // Size of the document in pixels as QSvgRenderer::defaultSize() would report it.
+    QSize defaultSize() const;
+
+    // Maps the view box of the document into rect in device coordinates.
+    void setTargetRect(const QRectF &rect);
+
+    // Appends about maxCount shapes in painting order to shapes. Returns false
+    // once the document has been read to the end and nothing was appended.
+    bool readShapes(QVector<Shape> *shapes, int maxCount);
+
+    bool hasError() const;
+    QString errorString() const;
+
+private:
+    // Inherited painting properties of the element being read
+    struct PaintState
+    {
+        QTransform transform;
+        QColor color = Qt::black;
+        QColor fill = Qt::black;
+        bool fillIsCurrentColor = false;
+        Qt::FillRule fillRule = Qt::WindingFill;
+        qreal fillOpacity = 1.0;
+        QColor stroke;
+        bool strokeIsCurrentColor = false;
+        qreal strokeOpacity = 1.0;
+        qreal strokeWidth = 1.0;
+        Qt::PenCapStyle capStyle = Qt::FlatCap;
+        Qt::PenJoinStyle joinStyle = Qt::SvgMiterJoin;
+        qreal miterLimit = 4.0;
+        QVector<qreal> dashPattern;
+        qreal opacity = 1.0;
+        bool visible = true;
+        bool displayed = true;
+        QString layer;
+    };
+
+    void applyAttributes(PaintState *state);
+    void applyProperty(PaintState *state, const QStringRef &name, const QStringRef &value);
+    bool parsePaint(const QStringRef &value, QColor *color, bool *isCurrentColor);
+    void warnUnsupported(const QString &what);
+
+    void readElement(QVector<Shape> *shapes);
+    void addShapes(const QPainterPath &path, bool fillable, QVector<Shape> *shapes);
+    qreal parseLength(const QStringRef &value, qreal percentBase) const;
+
+    QXmlStreamReader m_xml;
+    QRectF m_viewBox;
+    QSizeF m_size;
+    QTransform m_deviceTransform;
+    QVector<PaintState> m_stateStack;
+    QSet<QString> m_warnedAbout;
+};
+
+#endif // SVGSTREAMREADER_H
@@ -39,11 +39,21 @@ Item {
         }
     }
 
+    // Reload the field now and then to follow a progressive bake
+    Timer {
+        interval: 500
+        running: true
+        repeat: true
+        onTriggered: distanceField.generation++
+    }
+
     Image {
         anchors.centerIn: parent
         id: distanceField
+        property int generation: 0
         visible: false
-        source: "distancefield.png"
+        cache: false
+        source: "distancefield.png?" + generation
     }
 }
 
@@ -0,0 +1,156 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "distancefield.h"
+#include "runlength.h"
+#include "sdfcodec.h"
+
+#include <QImage>
+#include <QtGlobal>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// Run with "make check" in this directory. Every check that fails is
+// reported and the exit code counts them.
+
+static int failures = 0;
+
+static void check(bool condition, const char *what)
+{
+    if (!condition) {
+        qWarning("FAIL: %s", what);
+        failures++;
+    }
+}
+
+// A padded Format_Grayscale8 source of blocks, diagonals and specks, so that
+// the searches meet edges in every direction and pixels out of reach
+static QImage testSource(int width, int height, int searchRadius)
+{
+    QImage source(width + searchRadius * 2, height + searchRadius * 2, QImage::Format_Grayscale8);
+    srand(1);
+    for (int y = 0; y < source.height(); y++) {
+        uchar *line = source.scanLine(y);
+        for (int x = 0; x < source.width(); x++) {
+            bool dark = (x / 29 + y / 17) % 4 == 0 || (x + y) % 53 < 3 || rand() % 500 == 0;
+            line[x] = dark ? 0 : 255;
+        }
+    }
+    return source;
+}
+
+// Checks that an engine computes the field and the gradient of the brute
+// force search for a few search radii and thread counts
+template <typename Engine>
+static void testEngine(Engine engine, const char *what)
+{
+    for (int searchRadius : {1, 4, 11}) {
+        QImage source = testSource(211, 143, searchRadius);
+        QSize size(211, 143);
+        QImage expected(size, QImage::Format_Grayscale8), expectedGradient(size, QImage::Format_RGBA64);
+        bruteForceDistanceField(source, searchRadius, &expected, 4, &expectedGradient);
+
+        for (int numThreads : {1, 3}) {
+            QImage field(size, QImage::Format_Grayscale8), gradient(size, QImage::Format_RGBA64);
+            engine(source, searchRadius, &field, numThreads, &gradient);
+            int differing = 0, largest = 0;
+            compareFields(field, expected, &differing, &largest);
+            check(differing == 0, what);
+            bool sameGradient = true;
+            for (int y = 0; sameGradient && y < size.height(); y++)
+                sameGradient = memcmp(gradient.constScanLine(y), expectedGradient.constScanLine(y),
+                                      size.width() * 8) == 0;
+            check(sameGradient, what);
+        }
+    }
+}
+
+static void runs(const QImage &source, int searchRadius, QImage *field, int numThreads, QImage *gradient)
+{
+    runLengthDistanceField(RunLengthMask(source, numThreads), searchRadius, field, numThreads, gradient);
+}
+
+// Checks that the runs search computes the parts of the field a band or a
+// shard starting at an origin covers the same as the whole field
+static void testRunsOrigin()
+{
+    int searchRadius = 6;
+    QImage source = testSource(190, 160, searchRadius);
+    RunLengthMask mask(source, 2);
+    QImage whole(190, 160, QImage::Format_Grayscale8);
+    runLengthDistanceField(mask, searchRadius, &whole, 2);
+
+    QPoint origins[] = { QPoint(0, 50), QPoint(37, 0), QPoint(61, 83) };
+    for (const QPoint &origin : origins) {
+        QImage part(190 - origin.x(), qMin(60, 160 - origin.y()), QImage::Format_Grayscale8);
+        runLengthDistanceField(mask, searchRadius, &part, 2, nullptr, origin);
+        int differing = 0, largest = 0;
+        compareFields(part, whole.copy(QRect(origin, part.size())), &differing, &largest);
+        check(differing == 0, "the runs search computes a part of the field starting at its origin");
+    }
+}
+
+static void testCodec()
+{
+    QImage field = testSource(301, 97, 0);
+    for (int y = 0; y < field.height(); y++) {
+        uchar *line = field.scanLine(y);
+        for (int x = 0; x < field.width(); x++)
+            line[x] = line[x] ? uchar(x * 3 + y) : line[x];
+    }
+
+    for (int numThreads : {1, 4}) {
+        vector<unsigned char> data = encodeDistanceField(field.constBits(), field.width(), field.height(),
+                                                         field.bytesPerLine(), numThreads);
+        vector<unsigned char> texels;
+        int width = 0, height = 0;
+        check(decodeDistanceField(data.data(), data.size(), &texels, &width, &height, numThreads),
+              "the codec decodes what it encodes");
+        check(width == field.width() && height == field.height(), "the codec keeps the size");
+        bool same = int(texels.size()) == field.width() * field.height();
+        for (int y = 0; same && y < field.height(); y++)
+            same = memcmp(texels.data() + y * width, field.constScanLine(y), width) == 0;
+        check(same, "the codec is lossless");
+
+        data.resize(data.size() / 2);
+        check(!decodeDistanceField(data.data(), data.size(), &texels, &width, &height, numThreads),
+              "the codec rejects truncated data");
+    }
+}
+
+int main()
+{
+    testEngine(summedAreaDistanceField, "the summed-area search equals the brute force one");
+    testEngine(coherentDistanceField, "the coherent search equals the brute force one");
+    testEngine(runs, "the runs search equals the brute force one");
+    testRunsOrigin();
+    testCodec();
+    if (failures)
+        qWarning("%d checks failed", failures);
+    return failures;
+}
@@ -0,0 +1,19 @@
+QT += core gui
+
+TARGET = fieldtests
+CONFIG += console c++11 testcase
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += fieldtests.cpp \
+    ../distancefield.cpp \
+    ../runlength.cpp \
+    ../sdfcodec.cpp
+
+HEADERS += \
+    ../distancefield.h \
+    ../parallel.h \
+    ../runlength.h \
+    ../sdfcodec.h
@@ -0,0 +1,218 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "tiles.h"
+#include "parallel.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <atomic>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// Threads writing the encoded tiles while the others cut and encode
+static const int writerThreads = 2;
+
+// Copies the tile in the given column out of a row of tiles holding rowCount
+// texel rows, or returns its value if all of its texels have the same value
+static int cutTile(const QImage &tileRow, int rowCount, int width, int column, int tileSize, QImage *tile)
+{
+    int left = column * tileSize;
+    int value = tileRow.constScanLine(0)[left];
+    bool uniform = true;
+    for (int y = 0; y < tileSize; y++) {
+        const uchar *line = tileRow.constScanLine(qMin(y, rowCount - 1));
+        uchar *tileLine = tile->scanLine(y);
+        for (int x = 0; x < tileSize; x++) {
+            tileLine[x] = line[qMin(left + x, width - 1)];
+            uniform = uniform && tileLine[x] == value;
+        }
+    }
+    return uniform ? value : -1;
+}
+
+TilePyramidWriter::TilePyramidWriter(const QSize &size, const QString &directory, int tileSize,
+                                     int numThreads) :
+    m_directory(directory),
+    m_tileSize(tileSize),
+    m_numThreads(numThreads),
+    m_maxZoom(0),
+    m_encodedTiles(numThreads * 4),
+    m_written(true),
+    m_ok(true)
+{
+    while ((tileSize << m_maxZoom) < qMax(size.width(), size.height()))
+        m_maxZoom++;
+
+    // Every level halves the one below, repeating the last row and column of
+    // levels with an odd size
+    QSize levelSize = size;
+    for (int zoom = m_maxZoom; zoom >= 0; zoom--) {
+        Level level;
+        level.zoom = zoom;
+        level.size = levelSize;
+        level.tileRow = QImage(levelSize.width(), tileSize, QImage::Format_Grayscale8);
+        level.rowsAdded = 0;
+        int columns = (levelSize.width() + tileSize - 1) / tileSize;
+        int rows = (levelSize.height() + tileSize - 1) / tileSize;
+        level.values.assign(columns * rows, -1);
+        for (int column = 0; column < columns; column++)
+            m_ok = QDir().mkpath(QString("%1/%2/%3").arg(directory).arg(zoom).arg(column)) && m_ok;
+        m_levels.push_back(level);
+        levelSize = QSize((levelSize.width() + 1) / 2, (levelSize.height() + 1) / 2);
+    }
+
+    // Encoded tiles pass through a bounded queue to the writer threads, which
+    // caps the tiles in flight when the disk can't keep up with the encoders
+    for (int i = 0; i < writerThreads; i++) {
+        m_writers.push_back(thread([this]() {
+            EncodedTile tile;
+            while (m_encodedTiles.pop(&tile)) {
+                QFile file(tile.filename);
+                if (!file.open(QIODevice::WriteOnly) || file.write(tile.data) != tile.data.size())
+                    m_written = false;
+            }
+        }));
+    }
+}
+
+TilePyramidWriter::~TilePyramidWriter()
+{
+    stopWriters();
+}
+
+void TilePyramidWriter::addRows(const QImage &rows)
+{
+    for (int y = 0; y < rows.height(); y++)
+        addRow(0, rows.constScanLine(y));
+}
+
+void TilePyramidWriter::addRow(int levelIndex, const uchar *line)
+{
+    Level &level = m_levels[levelIndex];
+    if (level.rowsAdded >= level.size.height())
+        return;
+
+    int width = level.size.width();
+    int row = level.rowsAdded++;
+    memcpy(level.tileRow.scanLine(row % m_tileSize), line, width);
+    if (row % m_tileSize == m_tileSize - 1 || row == level.size.height() - 1)
+        writeTileRow(&level);
+    if (level.zoom == 0)
+        return;
+
+    // The last row of a level with an odd height is averaged with itself
+    if (row % 2 == 0 && row != level.size.height() - 1) {
+        level.pending.assign(line, line + width);
+        return;
+    }
+    const uchar *line0 = row % 2 == 0 ? line : level.pending.data();
+    vector<uchar> halfRow((width + 1) / 2);
+    for (int x = 0; x < int(halfRow.size()); x++) {
+        int x0 = x * 2;
+        int x1 = qMin(x0 + 1, width - 1);
+        halfRow[x] = (line0[x0] + line0[x1] + line[x0] + line[x1] + 2) / 4;
+    }
+    addRow(levelIndex + 1, halfRow.data());
+}
+
+void TilePyramidWriter::writeTileRow(Level *level)
+{
+    int row = (level->rowsAdded - 1) / m_tileSize;
+    int rowCount = level->rowsAdded - row * m_tileSize;
+    int columns = (level->size.width() + m_tileSize - 1) / m_tileSize;
+    atomic<int> nextColumn(0);
+    runThreads(qMin(m_numThreads, columns), [&](int) {
+        QImage tile(m_tileSize, m_tileSize, QImage::Format_Grayscale8);
+        for (int column = nextColumn++; column < columns; column = nextColumn++) {
+            int value = cutTile(level->tileRow, rowCount, level->size.width(), column, m_tileSize, &tile);
+            level->values[row * columns + column] = value;
+            if (value < 0) {
+                EncodedTile encoded;
+                encoded.filename = QString("%1/%2/%3/%4.png").arg(m_directory).arg(level->zoom)
+                        .arg(column).arg(row);
+                QBuffer buffer(&encoded.data);
+                buffer.open(QIODevice::WriteOnly);
+                tile.save(&buffer, "png");
+                m_encodedTiles.push(std::move(encoded));
+            }
+        }
+    });
+}
+
+void TilePyramidWriter::stopWriters()
+{
+    m_encodedTiles.close();
+    for (thread &writer : m_writers)
+        writer.join();
+    m_writers.clear();
+}
+
+bool TilePyramidWriter::finish()
+{
+    stopWriters();
+    bool ok = m_ok && m_written;
+    for (const Level &level : m_levels)
+        ok = ok && level.rowsAdded == level.size.height();
+
+    QJsonArray levels;
+    for (const Level &level : m_levels) {
+        int columns = (level.size.width() + m_tileSize - 1) / m_tileSize;
+        int rows = (level.size.height() + m_tileSize - 1) / m_tileSize;
+        QJsonArray tiles;
+        for (int row = 0; row < rows; row++) {
+            QJsonArray rowValues;
+            for (int column = 0; column < columns; column++)
+                rowValues.append(level.values[row * columns + column]);
+            tiles.append(rowValues);
+        }
+        QJsonObject levelEntry;
+        levelEntry.insert("zoom", level.zoom);
+        levelEntry.insert("width", level.size.width());
+        levelEntry.insert("height", level.size.height());
+        levelEntry.insert("tiles", tiles);
+        levels.prepend(levelEntry);
+    }
+
+    QJsonObject index;
+    index.insert("tileSize", m_tileSize);
+    index.insert("maxZoom", m_maxZoom);
+    index.insert("levels", levels);
+    QFile indexFile(m_directory + "/index.json");
+    return indexFile.open(QIODevice::WriteOnly) && indexFile.write(QJsonDocument(index).toJson()) > 0 && ok;
+}
+
+bool writeTilePyramid(const QImage &field, const QString &directory, int tileSize, int numThreads)
+{
+    TilePyramidWriter writer(field.size(), directory, tileSize, numThreads);
+    writer.addRows(field.convertToFormat(QImage::Format_Grayscale8));
+    return writer.finish();
+}
@@ -0,0 +1,102 @@
+/*
+-- Copyright (c) 2015, Juha Turunen (turunen@iki.fi)
+-- All rights reserved.
+--
+-- Redistribution and use in source and binary forms, with or without
+-- modification, are permitted provided that the following conditions are met:
+--
+-- 1. Redistributions of source code must retain the above copyright notice, this
+--    list of conditions and the following disclaimer.
+-- 2. Redistributions in binary form must reproduce the above copyright notice,
+--    this list of conditions and the following disclaimer in the documentation
+--    and/or other materials provided with the distribution.
+--
+-- THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+-- ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+-- WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+-- DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+-- ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+-- (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+-- LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+-- ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+-- (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+-- SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TILES_H
+#define TILES_H
+
+#include "boundedqueue.h"
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Writes a Format_Grayscale8 distance field as a pyramid of tileSize x tileSize
+// tiles into directory/zoom/x/y.png. The field itself is the deepest zoom level
+// and every level above it halves the size of the one below, down to a single
+// tile at zoom 0. Tiles at the right and bottom edges are padded by repeating
+// the last texels. Tiles of a single value, like those saturated inside or
+// outside of the shapes, aren't written at all. directory/index.json lists
+// the levels and, row by row, -1 for every written tile and the value of each
+// tile left out.
+//
+// The field comes in bands of rows from the top, and each row of tiles is
+// written once its last texel row is in. Besides that row of tiles, each
+// level above the deepest only holds a texel row waiting for the one below
+// it to be averaged with, so the field never has to be in memory as a whole.
+class TilePyramidWriter
+{
+public:
+    TilePyramidWriter(const QSize &size, const QString &directory, int tileSize, int numThreads);
+    // Waits for the tiles still being written
+    ~TilePyramidWriter();
+
+    // Adds the next rows of the field below the ones added before
+    void addRows(const QImage &rows);
+
+    // Writes the index once all rows have been added. Returns false if
+    // something couldn't be written.
+    bool finish();
+
+private:
+    struct EncodedTile
+    {
+        QString filename;
+        QByteArray data;
+    };
+
+    struct Level
+    {
+        int zoom;
+        QSize size;
+        // The tile row being filled, and the texel rows added to the level
+        QImage tileRow;
+        int rowsAdded;
+        // An even texel row waiting for the odd one below it
+        std::vector<uchar> pending;
+        std::vector<int> values;
+    };
+
+    void addRow(int level, const uchar *line);
+    void writeTileRow(Level *level);
+    void stopWriters();
+
+    QString m_directory;
+    int m_tileSize;
+    int m_numThreads;
+    int m_maxZoom;
+    std::vector<Level> m_levels;
+    BoundedQueue<EncodedTile> m_encodedTiles;
+    std::vector<std::thread> m_writers;
+    std::atomic<bool> m_written;
+    bool m_ok;
+};
+
+// Writes a field that is in memory as a whole with a TilePyramidWriter
+bool writeTilePyramid(const QImage &field, const QString &directory, int tileSize, int numThreads);
+
+#endif // TILES_H